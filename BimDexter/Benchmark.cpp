@@ -0,0 +1,444 @@
+// Benchmark.cpp
+
+#include <cstdio>
+#include <cctype>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <map>
+#include <thread>
+#include <exception>
+#include <stdexcept>
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#endif
+
+#include "Benchmark.h"
+#include "Pixmap.h"
+#include "PixelBlock.h"
+#include "ErrorStats.h"
+#include "JobQueue.h"
+#include "Common.h"
+
+using namespace std;
+using namespace std::chrono;
+
+
+// A compression mode to benchmark.
+struct BenchmarkMode {
+    char const* name;
+    int effort;
+    bool warmStart;
+    bool fixedPoint;
+    bool refinement;
+};
+
+
+BenchmarkMode benchmarkModes[] {
+    { "fast",      0, false, false, true  },
+    { "default",   1, false, false, true  },
+    { "warm",      1, true,  false, true  },
+    { "high",      2, false, false, true  },
+    { "fixed",     1, false, true,  true  },
+    { "unrefined", 1, false, false, false },
+};
+
+
+// Number of times each measurement is repeated. The fastest run is reported.
+const int REPEATS = 3;
+
+// Relative amount by which RMS error may grow before it counts as a regression.
+const double RMS_TOLERANCE = 0.005;
+
+// Relative amount by which maximum error may grow before it counts as a regression.
+const double MAX_ERROR_TOLERANCE = 0.1;
+
+
+// Result of compressing one image in one mode.
+struct BenchmarkResult {
+    string image;
+    int width;
+    int height;
+    string mode;
+    int threads;
+    double seconds;
+    double megapixelsPerSecond;
+    double peakMegabytes;
+    double rms;
+    int maxError;
+    double psnr;
+};
+
+
+// Resets the peak resident set size of the process. Only supported on Linux;
+// elsewhere the peak covers the whole run of the program.
+void reset_peak_memory()
+{
+#ifdef __linux__
+    ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+
+// Returns the peak resident set size of the process in bytes, or 0 if unknown.
+double peak_memory()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return (double)counters.PeakWorkingSetSize;
+#elif defined(__linux__)
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        // The value is given in kilobytes.
+        if (line.compare(0, 6, "VmHWM:") == 0) return atof(line.c_str() + 6) * 1024.0;
+    }
+#endif
+    return 0.0;
+}
+
+
+// Generates a stress image of the given kind: "noise", "gradient" or "photo".
+// Images are the same on every run.
+void generate(Pixmap& pixmap, string const& kind, int size)
+{
+    mt19937 random(1);
+    pixmap.resize(size, size);
+
+    if (kind == "noise") {
+        for (int y = 0; y < size; ++y)
+            for (int x = 0; x < size; ++x)
+                pixmap(x, y) = Pixel(random() & 0xff, random() & 0xff, random() & 0xff);
+    } else if (kind == "gradient") {
+        for (int y = 0; y < size; ++y)
+            for (int x = 0; x < size; ++x)
+                pixmap(x, y) = Pixel(x * 255 / (size - 1), y * 255 / (size - 1), (x + y) * 255 / (2 * size - 2));
+    } else {
+        // Value noise summed over octaves resembles natural image statistics:
+        // smooth regions, soft edges and fine detail.
+        const int LATTICE = 64;
+        vector<Vec3> lattice(LATTICE * LATTICE);
+        for (auto& v : lattice) v = Vec3((float)(random() & 0xff), (float)(random() & 0xff), (float)(random() & 0xff));
+
+        auto value = [&](float u, float v) {
+            int i = (int)floor(u);
+            int j = (int)floor(v);
+            float fu = u - i;
+            float fv = v - j;
+            auto at = [&](int a, int b) { return lattice[(b & (LATTICE - 1)) * LATTICE + (a & (LATTICE - 1))]; };
+            return Vec3::lerp(Vec3::lerp(at(i, j), at(i + 1, j), fu), Vec3::lerp(at(i, j + 1), at(i + 1, j + 1), fu), fv);
+        };
+
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                auto c = Vec3(0.0f);
+                float amplitude = 0.5f;
+                for (float scale = 256.0f; scale >= 2.0f; scale *= 0.5f, amplitude *= 0.5f)
+                    c += (value(x / scale, y / scale) - Vec3(128.0f)) * amplitude;
+                c += Vec3(128.0f);
+                c.clamp(Vec3(0.0f), Vec3(255.0f));
+                pixmap(x, y) = Pixel((uint8_t)c.x, (uint8_t)c.y, (uint8_t)c.z);
+            }
+        }
+    }
+}
+
+
+// Compresses the pixmap in the mode into the scratch DDS file, decodes it and measures
+// the result. The file is written the same way as by the program, straight from the
+// compression jobs.
+BenchmarkResult measure(Pixmap& pixmap, string const& image, BenchmarkMode const& mode, int threads, string const& scratch)
+{
+    PixelBlock::setEffort(mode.effort);
+    PixelBlock::setWarmStart(mode.warmStart);
+    PixelBlock::setFixedPoint(mode.fixedPoint);
+    PixelBlock::setRefinement(mode.refinement);
+    JobQueue::setThreads(threads);
+
+    BenchmarkResult result;
+    result.seconds = 1.0e10;
+
+    for (int i = 0; i < REPEATS; ++i) {
+        reset_peak_memory();
+        auto time0 = steady_clock::now();
+        pixmap.export_dxt1(scratch, false);
+        auto time1 = steady_clock::now();
+        result.seconds = min(result.seconds, duration<double>(time1 - time0).count());
+        result.peakMegabytes = peak_memory() / (1 << 20);
+    }
+
+    Pixmap decoded;
+    ifstream dds(scratch, ios::binary);
+    if (!dds.is_open()) throw runtime_error("Cannot open benchmark output.");
+    decoded.read_dxt1(dds, false);
+
+    ErrorStats stats;
+    for (int y = 0; y < pixmap.sizeY(); ++y)
+        for (int x = 0; x < pixmap.sizeX(); ++x)
+            stats.add(pixmap(x, y), decoded(x, y));
+
+    result.image = image;
+    result.width = pixmap.sizeX();
+    result.height = pixmap.sizeY();
+    result.mode = mode.name;
+    result.threads = threads;
+    result.megapixelsPerSecond = result.width * (double)result.height * 1.0e-6 / max(result.seconds, 1.0e-9);
+    result.rms = stats.rms();
+    result.maxError = stats.maximum;
+    result.psnr = stats.psnr();
+    return result;
+}
+
+
+// Returns the file name without directories.
+string base_name(string const& filename)
+{
+    auto slash = filename.find_last_of("/\\");
+    return slash == string::npos ? filename : filename.substr(slash + 1);
+}
+
+
+const char* CSV_HEADER = "image,width,height,mode,threads,seconds,mpps,peak_rss_mb,rms,max_error,psnr";
+
+
+void write_csv(ostream& s, vector<BenchmarkResult> const& results)
+{
+    s << CSV_HEADER << "\n";
+    for (auto& r : results) {
+        s << csv_field(r.image) << "," << r.width << "," << r.height << "," << csv_field(r.mode) << "," << r.threads << ","
+          << setprecision(4) << fixed << r.seconds << "," << setprecision(3) << r.megapixelsPerSecond << ","
+          << setprecision(1) << r.peakMegabytes << "," << setprecision(4) << r.rms << ","
+          << r.maxError << "," << setprecision(3) << r.psnr << "\n";
+    }
+}
+
+
+void write_json(ostream& s, vector<BenchmarkResult> const& results)
+{
+    s << "[\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto& r = results[i];
+        s << "  { \"image\": " << json_string(r.image) << ", \"width\": " << r.width << ", \"height\": " << r.height
+          << ", \"mode\": " << json_string(r.mode) << ", \"threads\": " << r.threads
+          << setprecision(4) << fixed << ", \"seconds\": " << r.seconds
+          << setprecision(3) << ", \"mpps\": " << r.megapixelsPerSecond
+          << setprecision(1) << ", \"peak_rss_mb\": " << r.peakMegabytes
+          << setprecision(4) << ", \"rms\": " << r.rms << ", \"max_error\": " << r.maxError
+          << setprecision(3) << ", \"psnr\": " << r.psnr << " }" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    s << "]\n";
+}
+
+
+// Splits a CSV line into fields. Fields may be quoted as by csv_field; unquoted fields
+// are trimmed of surrounding spaces.
+vector<string> split_csv(string const& line)
+{
+    vector<string> fields;
+    size_t i = 0;
+    while (true) {
+        string field;
+        while (i < line.size() && line[i] == ' ') ++i;
+        if (i < line.size() && line[i] == '"') {
+            for (++i; i < line.size(); ++i) {
+                if (line[i] == '"') {
+                    if (i + 1 < line.size() && line[i + 1] == '"') ++i; else break;
+                }
+                field += line[i];
+            }
+            ++i;
+            while (i < line.size() && line[i] != ',') ++i;
+        } else {
+            auto end = line.find(',', i);
+            if (end == string::npos) end = line.size();
+            field = line.substr(i, end - i);
+            field.erase(field.find_last_not_of(" \r") + 1);
+            i = end;
+        }
+        fields.push_back(field);
+        if (i >= line.size()) break;
+        ++i;
+    }
+    return fields;
+}
+
+
+// Reads a CSV file written by write_csv.
+vector<BenchmarkResult> read_csv(istream& s)
+{
+    vector<BenchmarkResult> results;
+    string line;
+
+    getline(s, line);
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line != CSV_HEADER) throw runtime_error("Benchmark baseline is not a benchmark CSV file.");
+
+    while (getline(s, line)) {
+        if (line.find_first_not_of(" \r") == string::npos) continue;
+        auto fields = split_csv(line);
+        if (fields.size() != 11) throw runtime_error("Malformed line in benchmark baseline.");
+        // The numbers follow the image and mode fields.
+        istringstream numbers(fields[1] + " " + fields[2] + " " + fields[4] + " " + fields[5] + " " + fields[6] + " "
+                              + fields[7] + " " + fields[8] + " " + fields[9] + " " + fields[10]);
+        BenchmarkResult r;
+        r.image = fields[0];
+        r.mode = fields[3];
+        numbers >> r.width >> r.height >> r.threads >> r.seconds >> r.megapixelsPerSecond >> r.peakMegabytes
+                >> r.rms >> r.maxError >> r.psnr;
+        if (!numbers || !(numbers >> ws).eof()) throw runtime_error("Malformed line in benchmark baseline.");
+        results.push_back(r);
+    }
+
+    return results;
+}
+
+
+// Returns the key that matches a result with its baseline. Multithreaded results are
+// matched with each other even if the thread counts differ.
+string baseline_key(BenchmarkResult const& r)
+{
+    return r.image + " " + r.mode + (r.threads > 1 ? " threads" : " single");
+}
+
+
+// Compares results against the baseline and prints regressions. Returns their number.
+int compare(vector<BenchmarkResult> const& results, vector<BenchmarkResult> const& baseline, double speed_tolerance)
+{
+    map<string, BenchmarkResult const*> index;
+    for (auto& r : baseline) index[baseline_key(r)] = &r;
+
+    int regressions = 0;
+
+    auto check = [&](BenchmarkResult const& r, char const* what, bool regressed, double value, double reference) {
+        if (!regressed) return;
+        cerr << "Regression: " << r.image << " " << r.mode << " " << r.threads << " threads: "
+             << what << " " << value << " (baseline " << reference << ")\n";
+        ++regressions;
+    };
+
+    for (auto& r : results) {
+        auto i = index.find(baseline_key(r));
+        if (i == index.end()) continue;
+        auto& b = *i->second;
+        check(r, "RMS error", r.rms > b.rms * (1.0 + RMS_TOLERANCE) + 1.0e-4, r.rms, b.rms);
+        check(r, "max error", r.maxError > b.maxError * (1.0 + MAX_ERROR_TOLERANCE), r.maxError, b.maxError);
+        check(r, "MP/s", r.megapixelsPerSecond < b.megapixelsPerSecond * (1.0 - speed_tolerance), r.megapixelsPerSecond, b.megapixelsPerSecond);
+        // Memory is only compared when both sides could measure it.
+        check(r, "peak RSS MB", r.peakMegabytes > 0.0 && r.peakMegabytes > b.peakMegabytes * (1.0 + speed_tolerance) + 1.0,
+              r.peakMegabytes, b.peakMegabytes);
+    }
+
+    return regressions;
+}
+
+
+int run_benchmark(vector<string> const& files, string const& report, string const& baseline, double speed_tolerance, bool verbose)
+{
+    vector<BenchmarkResult> expected;
+
+    if (!baseline.empty()) {
+        ifstream s(baseline);
+        if (!s.is_open()) throw runtime_error("Cannot open benchmark baseline.");
+        expected = read_csv(s);
+    }
+
+    // Thread counts to run: 1 and the default. The multithreaded code runs with at least
+    // 2 threads even on a single core.
+    int threads = JobQueue::threads > 0 ? JobQueue::threads : (int)thread::hardware_concurrency();
+    vector<int> thread_counts { 1, max(2, threads) };
+
+    // Settings are restored at the end.
+    int effort = PixelBlock::effort;
+    bool warmStart = PixelBlock::warmStart;
+    bool fixedPoint = PixelBlock::fixedPoint;
+    bool refinement = PixelBlock::refinement;
+    int queueThreads = JobQueue::threads;
+
+    // Directories stand for the BMP files in them.
+    vector<string> images;
+    for (auto& file : files) {
+        if (!is_directory(file)) {
+            images.push_back(file);
+            continue;
+        }
+        vector<string> names;
+        for (auto& entry : list_files(file)) {
+            auto name = entry.name;
+            for (auto& c : name) c = (char)tolower((unsigned char)c);
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".bmp") == 0) names.push_back(entry.name);
+        }
+        sort(names.begin(), names.end());
+        for (auto& name : names) images.push_back(file + "/" + name);
+    }
+    images.push_back("generated:noise");
+    images.push_back("generated:gradient");
+    images.push_back("generated:photo");
+
+    vector<BenchmarkResult> results;
+    auto scratch = report + ".tmp.dds";
+
+    for (auto& image : images) {
+        Pixmap pixmap;
+        string name;
+
+        if (image.compare(0, 10, "generated:") == 0) {
+            name = image.substr(10);
+            generate(pixmap, name, name == "photo" ? 2048 : 1024);
+        } else {
+            ifstream s(image, ios::binary);
+            if (!s.is_open()) throw runtime_error("Cannot open benchmark image " + image + ".");
+            pixmap.read_bmp(s, false);
+            name = base_name(image);
+        }
+
+        for (auto& mode : benchmarkModes) {
+            for (auto threads : thread_counts) {
+                results.push_back(measure(pixmap, name, mode, threads, scratch));
+                auto& r = results.back();
+                if (verbose) {
+                    cerr << setw(24) << left << r.image << right << setw(10) << r.mode << setw(3) << r.threads << " threads "
+                         << fixed << setprecision(2) << setw(8) << r.megapixelsPerSecond << " MP/s "
+                         << setprecision(1) << setw(7) << r.peakMegabytes << " MB  RMS "
+                         << setprecision(3) << r.rms << "  max " << r.maxError << "  PSNR " << setprecision(2) << r.psnr << " dB\n";
+                }
+            }
+        }
+
+        // Report the gain of 565 refinement by comparing the default mode with the unrefined one.
+        if (verbose) {
+            double refined = 0.0, unrefined = 0.0;
+            for (auto& r : results) {
+                if (r.image != name || r.threads != 1) continue;
+                if (r.mode == "default") refined = r.rms;
+                if (r.mode == "unrefined") unrefined = r.rms;
+            }
+            if (unrefined > 0.0) {
+                cerr << setw(24) << left << name << right << " 565 refinement: RMS " << setprecision(3) << unrefined << " -> " << refined
+                     << " (" << setprecision(2) << 100.0 * (unrefined - refined) / unrefined << "% lower)\n";
+            }
+        }
+    }
+
+    PixelBlock::setEffort(effort);
+    PixelBlock::setWarmStart(warmStart);
+    PixelBlock::setFixedPoint(fixedPoint);
+    PixelBlock::setRefinement(refinement);
+    JobQueue::setThreads(queueThreads);
+    remove(scratch.c_str());
+
+    ofstream s(report);
+    if (!s.is_open()) throw runtime_error("Cannot open benchmark report file.");
+    auto json = report.size() >= 5 && report.compare(report.size() - 5, 5, ".json") == 0;
+    if (json) write_json(s, results); else write_csv(s, results);
+
+    return expected.empty() ? 0 : compare(results, expected, speed_tolerance);
+}
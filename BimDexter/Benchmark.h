@@ -0,0 +1,26 @@
+// Benchmark.h
+// Whole-image compression benchmark with regression checking.
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+// Compresses each BMP file, the BMP files in each directory given, and a set of
+// generated stress images (noise, gradients and a large synthetic photo) in each
+// compression mode with 1 thread and with the default number of threads, but at least 2.
+// Each run writes a scratch DDS file next to the report. Records speed, peak memory and
+// error statistics to the report file as CSV, or as JSON if the file name ends in ".json".
+// If a baseline CSV file is given, results are compared against it; multithreaded results
+// are compared with multithreaded ones whatever the thread counts. Quality may not
+// get worse by more than a small fixed tolerance, and speed and memory may not get
+// worse by more than speed_tolerance (a fraction). Regressions are printed to stderr.
+// Returns the number of regressions. Throws runtime_error if something goes wrong.
+int run_benchmark(vector<string> const& files, string const& report, string const& baseline, double speed_tolerance, bool verbose);
+
+
+#endif // BENCHMARK_H
@@ -3,12 +3,26 @@
 
 #include <string>
 #include <iostream>
+#include <sstream>
 #include <locale>
 #include <exception>
 #include <chrono>
+#include <vector>
+#include <functional>
+#include <iomanip>
+#include <cstdlib>
+#include <memory>
 
 #include "Pixmap.h"
 #include "PixelBlock.h"
+#include "DxtImage.h"
+#include "Estimate.h"
+#include "JobQueue.h"
+#include "Benchmark.h"
+#include "Cache.h"
+#include "ErrorStats.h"
+#include "Shard.h"
+#include "Common.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -16,14 +30,68 @@ using namespace std::chrono;
 
 void usage()
 {
-    cerr << "Usage: BimDexter [-b | -d] [-q] [-u] {input file} {output file}\n";
+    cerr << "Usage: BimDexter [-b | -d | -t] [-cache {directory}] [-cache-size {MB}] [-e {effort}] [-fixed] [-j {threads}] [-level {level}] [-metrics {file}] [-mips] [-norefine] [-preview {file}] [-q] [-surface {index}] [-u] [-w] [-x] [transforms] {input file} {output file}\n";
+    cerr << "       BimDexter [-b] [-cube] [options] {input BMP files} {output DDS file}\n";
+    cerr << "       BimDexter -shard {index} {count} [options] {input BMP file} {output shard file}\n";
+    cerr << "       BimDexter -merge [-metrics {file}] [-q] {shard files} {output DDS file}\n";
+    cerr << "       BimDexter -estimate {percent} [-fixed] [-j {threads}] [-norefine] [-u] [-w] [-x] {input file}\n";
+    cerr << "       BimDexter -cache {directory} -cache-stats\n";
+    cerr << "       BimDexter -benchmark {report file} [-baseline {file}] [-tolerance {percent}] [-j {threads}] [BMP files and directories]\n";
     cerr << "Converts between .BMP (24-bit uncompressed) and .DDS (DXT1) files.\n";
-    cerr << "If not specified, the mode is chosen based on the extension of the input file.\n";
+    cerr << "If not specified, the mode is chosen based on the extensions of the files.\n";
     cerr << "Options:\n";
     cerr << "  -b  Set mode: input BMP and output DDS.\n";
     cerr << "  -d  Set mode: input DDS and output BMP.\n";
+    cerr << "  -t  Set mode: input DDS and output DDS, applying transforms without re-encoding.\n";
+    cerr << "  -estimate  Compress a sample of blocks from a BMP file at each effort level and\n";
+    cerr << "             print estimated RMS error, a lower bound of the maximum error and the\n";
+    cerr << "             time of a run with the number of threads.\n";
+    cerr << "  -benchmark  Compress the BMP files, the BMP files in the directories and generated stress\n";
+    cerr << "              images in each mode with 1 and the default number (at least 2) of threads.\n";
+    cerr << "              Writes speed, memory and error statistics as CSV, or as JSON if the report\n";
+    cerr << "              file name ends in .json.\n";
+    cerr << "  -baseline   Compare benchmark results against a CSV report. Exits with status 2\n";
+    cerr << "              if there are regressions.\n";
+    cerr << "  -tolerance  Allowed loss of benchmark speed and memory in percent. Default is 25.\n";
+    cerr << "  -shard  Compress a share of the block rows of a BMP file into a shard file. Shards\n";
+    cerr << "          0 to {count} - 1 can be compressed by separate processes or machines.\n";
+    cerr << "  -merge  Join shard files into a DDS file. Metrics cover the whole image, with the\n";
+    cerr << "          total compression time of the shards.\n";
+    cerr << "  -cache  Store compressed images in the directory and reuse them when the input pixels\n";
+    cerr << "          and options match. Defaults to the BIMDEXTER_CACHE environment variable.\n";
+    cerr << "  -cache-size   Maximum cache size in megabytes. Default is 1024.\n";
+    cerr << "  -cache-stats  Print cache hit and miss counts and size.\n";
+    cerr << "  -cube  Compress the BMP files as cube map faces in the order +X, -X, +Y, -Y, +Z, -Z.\n";
+    cerr << "         Multiples of 6 files make an array of cube maps. Without -cube, several BMP\n";
+    cerr << "         files make a texture array.\n";
+    cerr << "  -e  Set compression effort: 0 (fast), 1 (default) or 2 (high).\n";
+    cerr << "  -fixed  Compress with the fixed-point engine. Output is identical on every platform\n";
+    cerr << "          and build, and quality is within 1% RMS of the default engine.\n";
+    cerr << "  -j  Set number of threads. Default is one per hardware thread.\n";
+    cerr << "  -level  Select mipmap level to decode from a DDS file. Default is 0 (full size).\n";
+    cerr << "  -metrics  When compressing, write the error statistics of the compressed image\n";
+    cerr << "            as CSV, or as JSON if the file name ends in .json.\n";
+    cerr << "  -mips   Write a full mipmap chain to the DDS file.\n";
+    cerr << "  -norefine  Skip refinement of the quantized 565 colors and run a longer gradient\n";
+    cerr << "             descent instead. Lower quality.\n";
+    cerr << "  -preview  When compressing, also write the decoded image to a BMP file. The blocks\n";
+    cerr << "            are decoded as they are compressed; no file is read back.\n";
     cerr << "  -q  Suppress diagnostic output to stderr.\n";
+    cerr << "  -surface  Select texture array element or cube map face to decode from a DDS file.\n";
+    cerr << "            Default is 0.\n";
     cerr << "  -u  Choose uniform color component weighting. Default is (3, 4, 2) (R, G, B).\n";
+    cerr << "  -w  Warm-start compression from neighboring blocks' palettes. Saves about a\n";
+    cerr << "      quarter of the time at effort 1 and 2 for a slightly higher error.\n";
+    cerr << "  -x  Select pixel colors by exhaustive search instead of projection (not with -fixed).\n";
+    cerr << "Transforms (imply -t, applied in order):\n";
+    cerr << "  -flipx               Mirror horizontally.\n";
+    cerr << "  -flipy               Mirror vertically.\n";
+    cerr << "  -transpose           Swap X and Y axes.\n";
+    cerr << "  -rot90, -rot180, -rot270\n";
+    cerr << "                       Rotate clockwise.\n";
+    cerr << "  -crop {x} {y} {w} {h}\n";
+    cerr << "                       Crop to rectangle. Values must be divisible by 4.\n";
+    cerr << "  -tile {w} {h}        Slice into tiles written to {output}_{column}_{row}.dds.\n";
 }
 
 
@@ -42,13 +110,103 @@ bool has_suffix(string const& s, string const& suffix)
 }
 
 
+// Parses the command line argument at index i as a non-negative integer.
+// Returns false if there is no such argument or it is not a number.
+bool parse_int(int argc, char** argv, int i, int& x)
+{
+    if (i >= argc) return false;
+    char* end;
+    long value = strtol(argv[i], &end, 10);
+    if (end == argv[i] || *end != 0 || value < 0 || value > (1 << 30)) return false;
+    x = (int)value;
+    return true;
+}
+
+
+// Returns the filename with the tile position inserted before the extension.
+string tile_filename(string const& filename, int column, int row)
+{
+    auto suffix = "_" + to_string(column) + "_" + to_string(row);
+    auto dot = filename.rfind('.');
+    auto slash = filename.find_last_of("/\\");
+    if (dot == string::npos || (slash != string::npos && dot < slash)) return filename + suffix;
+    return filename.substr(0, dot) + suffix + filename.substr(dot);
+}
+
+
+// Decodes the full size image of the first surface of a DDS stream into the preview,
+// if given, and adds the errors of all surfaces against the originals to the statistics,
+// if given.
+void decode_dds(istream& s, vector<Pixmap const*> const& originals, Pixmap* preview, ErrorStats* stats)
+{
+    for (int surface = 0; surface < (stats ? (int)originals.size() : 1); ++surface) {
+        Pixmap decoded;
+        auto& target = preview && surface == 0 ? *preview : decoded;
+        s.clear();
+        s.seekg(0);
+        target.read_dxt1(s, false, 0, surface);
+
+        auto& original = *originals[surface];
+        if (stats) {
+            for (int y = 0; y < original.sizeY(); ++y)
+                for (int x = 0; x < original.sizeX(); ++x)
+                    stats->add(original(x, y), target(x, y));
+        }
+    }
+}
+
+
+// Writes the error statistics of a compressed image as CSV, or as JSON if the
+// file name ends in .json. Throws runtime_error if the file cannot be written.
+void write_metrics(string const& filename, string const& image, int width, int height, ErrorStats const& stats, double seconds)
+{
+    ofstream s(filename);
+    if (!s.is_open()) throw runtime_error("Cannot open metrics file.");
+
+    s << fixed;
+    if (has_suffix(filename, ".json")) {
+        s << "{ \"image\": " << json_string(image) << ", \"width\": " << width << ", \"height\": " << height
+          << setprecision(4) << ", \"seconds\": " << seconds << ", \"rms\": " << stats.rms()
+          << ", \"max_error\": " << stats.maximum << setprecision(3) << ", \"psnr\": " << stats.psnr() << " }\n";
+    } else {
+        s << "image,width,height,seconds,rms,max_error,psnr\n"
+          << csv_field(image) << "," << width << "," << height << "," << setprecision(4) << seconds << ","
+          << stats.rms() << "," << stats.maximum << "," << setprecision(3) << stats.psnr() << "\n";
+    }
+
+    if (!s) throw runtime_error("Cannot write metrics file.");
+}
+
+
+enum Mode { BMP_TO_DDS, DDS_TO_BMP, DDS_TO_DDS, ESTIMATE, BENCHMARK, MERGE };
+
+
 int main(int argc, char** argv)
 {
-    string filename[2];
-    int filenames = 0;
+    vector<string> filename;
     bool verbose = true;
-    bool bmp_to_dds;
+    Mode mode;
     bool mode_specified = false;
+    vector<function<void (DxtImage&)>> transforms;
+    int tileX = 0;
+    int tileY = 0;
+    double sample_percent = 0.0;
+    bool mips = false;
+    int level = 0;
+    int surface = 0;
+    bool cubemap = false;
+    int shard = 0;
+    int shards = 0;
+    string report;
+    string baseline;
+    int tolerance = 25;
+    string cache_directory;
+    int cache_size = Cache::DEFAULT_SIZE_MB;
+    bool cache_statistics = false;
+    string preview_file;
+    string metrics_file;
+
+    if (getenv("BIMDEXTER_CACHE")) cache_directory = getenv("BIMDEXTER_CACHE");
 
     // Parse command line arguments.
     for (int i = 1; i < argc; ++i) {
@@ -56,71 +214,346 @@ int main(int argc, char** argv)
         std::string arg = argv[i];
 
         if (arg == "-b") {
-            bmp_to_dds = true;
+            mode = BMP_TO_DDS;
             mode_specified = true;
         } else if (arg == "-d") {
-            bmp_to_dds = false;
+            mode = DDS_TO_BMP;
+            mode_specified = true;
+        } else if (arg == "-t") {
+            mode = DDS_TO_DDS;
             mode_specified = true;
+        } else if (arg == "-estimate") {
+            char* end = nullptr;
+            if (i + 1 < argc) sample_percent = strtod(argv[i + 1], &end);
+            if (end == nullptr || *end != 0 || !(sample_percent > 0.0 && sample_percent <= 100.0)) {
+                usage();
+                return 0;
+            }
+            ++i;
+            mode = ESTIMATE;
+            mode_specified = true;
+        } else if (arg == "-benchmark" || arg == "-baseline") {
+            if (i + 1 >= argc) {
+                usage();
+                return 0;
+            }
+            (arg == "-benchmark" ? report : baseline) = argv[++i];
+            if (arg == "-benchmark") {
+                mode = BENCHMARK;
+                mode_specified = true;
+            }
+        } else if (arg == "-shard") {
+            if (!parse_int(argc, argv, i + 1, shard) || !parse_int(argc, argv, i + 2, shards) || shard >= shards) {
+                usage();
+                return 0;
+            }
+            i += 2;
+        } else if (arg == "-merge") {
+            mode = MERGE;
+            mode_specified = true;
+        } else if (arg == "-tolerance") {
+            if (!parse_int(argc, argv, i + 1, tolerance)) {
+                usage();
+                return 0;
+            }
+            ++i;
+        } else if (arg == "-cache") {
+            if (i + 1 >= argc) {
+                usage();
+                return 0;
+            }
+            cache_directory = argv[++i];
+        } else if (arg == "-cache-size") {
+            if (!parse_int(argc, argv, i + 1, cache_size)) {
+                usage();
+                return 0;
+            }
+            ++i;
+        } else if (arg == "-cache-stats") {
+            cache_statistics = true;
+        } else if (arg == "-cube") {
+            cubemap = true;
+        } else if (arg == "-e") {
+            int effort;
+            if (!parse_int(argc, argv, i + 1, effort) || effort >= PixelBlock::EFFORTS) {
+                usage();
+                return 0;
+            }
+            ++i;
+            PixelBlock::setEffort(effort);
+        } else if (arg == "-fixed") {
+            PixelBlock::setFixedPoint(true);
+        } else if (arg == "-j") {
+            int threads;
+            if (!parse_int(argc, argv, i + 1, threads)) {
+                usage();
+                return 0;
+            }
+            ++i;
+            JobQueue::setThreads(threads);
+        } else if (arg == "-level") {
+            if (!parse_int(argc, argv, i + 1, level)) {
+                usage();
+                return 0;
+            }
+            ++i;
+        } else if (arg == "-metrics" || arg == "-preview") {
+            if (i + 1 >= argc) {
+                usage();
+                return 0;
+            }
+            (arg == "-metrics" ? metrics_file : preview_file) = argv[++i];
+        } else if (arg == "-mips") {
+            mips = true;
+        } else if (arg == "-norefine") {
+            PixelBlock::setRefinement(false);
         } else if (arg == "-q") {
             verbose = false;
+        } else if (arg == "-surface") {
+            if (!parse_int(argc, argv, i + 1, surface)) {
+                usage();
+                return 0;
+            }
+            ++i;
         } else if (arg == "-u") {
             DxtPalette::setColorImportance(Vec3(1.0f));
-        } else if (filenames < 2) {
-            filename[filenames++] = arg;
+        } else if (arg == "-w") {
+            PixelBlock::setWarmStart(true);
+        } else if (arg == "-x") {
+            DxtPalette::setExactEncoding(true);
+        } else if (arg == "-flipx") {
+            transforms.push_back([](DxtImage& image) { image.flip_x(); });
+        } else if (arg == "-flipy") {
+            transforms.push_back([](DxtImage& image) { image.flip_y(); });
+        } else if (arg == "-transpose") {
+            transforms.push_back([](DxtImage& image) { image.transpose(); });
+        } else if (arg == "-rot90" || arg == "-rot180" || arg == "-rot270") {
+            int quarter_turns = arg == "-rot90" ? 1 : arg == "-rot180" ? 2 : 3;
+            transforms.push_back([=](DxtImage& image) { image.rotate(quarter_turns); });
+        } else if (arg == "-crop") {
+            int x, y, w, h;
+            if (!parse_int(argc, argv, i + 1, x) || !parse_int(argc, argv, i + 2, y) ||
+                !parse_int(argc, argv, i + 3, w) || !parse_int(argc, argv, i + 4, h)) {
+                usage();
+                return 0;
+            }
+            i += 4;
+            transforms.push_back([=](DxtImage& image) {
+                DxtImage region;
+                region.crop(image, x, y, w, h);
+                swap(image, region);
+            });
+        } else if (arg == "-tile") {
+            if (!parse_int(argc, argv, i + 1, tileX) || !parse_int(argc, argv, i + 2, tileY)) {
+                usage();
+                return 0;
+            }
+            i += 2;
         } else {
+            filename.push_back(arg);
+        }
+    }
+
+    if (mode_specified && mode == BENCHMARK) {
+        try {
+            int regressions = run_benchmark(filename, report, baseline, tolerance * 0.01, verbose);
+            if (regressions > 0) {
+                cerr << regressions << " regressions found.\n";
+                return 2;
+            }
+        } catch(runtime_error e) {
+            cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    if (cache_statistics) {
+        if (cache_directory.empty()) {
             usage();
             return 0;
         }
+        try {
+            Cache(cache_directory, cache_size).print_statistics(cout);
+        } catch(runtime_error e) {
+            cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        return 0;
     }
 
-    if (filenames < 2) {
+    if (mode_specified && mode == ESTIMATE ? filename.size() != 1 : filename.size() < 2) {
         usage();
         return 0;
     }
 
     if (!mode_specified) {
-        if (has_suffix(filename[0], ".dds")) {
-            bmp_to_dds = false;
+        if (!transforms.empty() || tileX > 0) {
+            mode = DDS_TO_DDS;
+        } else if (has_suffix(filename[0], ".dds")) {
+            mode = has_suffix(filename[1], ".dds") ? DDS_TO_DDS : DDS_TO_BMP;
         } else if (has_suffix(filename[0], ".bmp")) {
-            bmp_to_dds = true;
+            mode = BMP_TO_DDS;
         } else {
             cerr << "Error: Cannot deduce mode from input file extension.\n";
             return 1;
         }
     }
 
+    // Several input files and the preview, metrics and cube map options are only for compression.
+    // Shards have one input and no mipmaps, and their metrics come from the merge.
+    if ((filename.size() > 2 && mode != BMP_TO_DDS && mode != MERGE) || (cubemap && mode != BMP_TO_DDS) || (!preview_file.empty() && mode != BMP_TO_DDS) ||
+        (!metrics_file.empty() && mode != BMP_TO_DDS && mode != MERGE) ||
+        (shards > 0 && (mode != BMP_TO_DDS || filename.size() > 2 || cubemap || mips || !preview_file.empty() || !metrics_file.empty()))) {
+        usage();
+        return 0;
+    }
+
     Pixmap pixmap;
 
     ifstream infile;
     ofstream outfile;
 
-    if (bmp_to_dds) {
+    if (mode == BMP_TO_DDS && shards > 0) {
+        try {
+            export_shard(filename[0], filename[1], shard, shards, verbose);
+        } catch(runtime_error e) {
+            cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    } else if (mode == MERGE) {
+        try {
+            ErrorStats stats;
+            int width, height;
+            double seconds;
+            vector<string> inputs(filename.begin(), filename.end() - 1);
+            merge_shards(inputs, filename.back(), verbose, width, height, seconds, metrics_file.empty() ? nullptr : &stats);
+            if (!metrics_file.empty()) {
+                write_metrics(metrics_file, filename.back(), width, height, stats, seconds);
+                if (verbose) cerr << "Metrics written: RMS " << stats.rms() << ", maximum error " << stats.maximum << ", PSNR " << stats.psnr() << " dB.\n";
+            }
+        } catch(runtime_error e) {
+            cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    } else if (mode == BMP_TO_DDS) {
+        try {
+            // All files except the last are input surfaces.
+            auto output = filename.back();
+            vector<unique_ptr<Pixmap>> pixmaps;
+            vector<Pixmap const*> surfaces;
+            for (size_t i = 0; i + 1 < filename.size(); ++i) {
+                infile.open(filename[i], ios::binary);
+                if (!infile.is_open()) throw runtime_error("Cannot open input file " + filename[i] + ".");
+                pixmaps.emplace_back(new Pixmap());
+                pixmaps.back()->read_bmp(infile, verbose);
+                infile.close();
+                surfaces.push_back(pixmaps.back().get());
+            }
+            // The preview and the statistics are made from the blocks as they are compressed.
+            Pixmap preview;
+            ErrorStats stats;
+            auto previewTarget = preview_file.empty() ? nullptr : &preview;
+            auto statsTarget = metrics_file.empty() ? nullptr : &stats;
+            double time0 = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+            if (cache_directory.empty()) {
+                // Compression jobs write straight into the output file.
+                Pixmap::export_dxt1(output, surfaces, cubemap, verbose, mips, previewTarget, statsTarget);
+            } else {
+                // Check that the surfaces fit together before anything is written.
+                Pixmap::dds_size(surfaces, cubemap, mips);
+                outfile.open(output, ios::binary);
+                if (!outfile.is_open()) throw runtime_error("Cannot open output file.");
+                Cache cache(cache_directory, cache_size);
+                auto key = Cache::key(surfaces, cubemap, mips);
+                // A cached image has no compression state to reuse, so it is fetched
+                // into memory and decoded there if a preview or metrics are wanted.
+                bool decode = previewTarget || statsTarget;
+                stringstream dds;
+                if (cache.fetch(key, decode ? (ostream&)dds : outfile)) {
+                    if (verbose) cerr << "DDS image copied from cache.\n";
+                    if (decode) {
+                        outfile << dds.str();
+                        decode_dds(dds, surfaces, previewTarget, statsTarget);
+                    }
+                } else {
+                    Pixmap::export_dxt1(dds, surfaces, cubemap, verbose, mips, previewTarget, statsTarget);
+                    outfile << dds.rdbuf();
+                    cache.insert(key, dds.str());
+                }
+                outfile.close();
+            }
+            double time1 = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+            if (verbose) cerr << "Time taken: " << (time1 - time0) * 0.001 << " seconds.\n";
+            if (previewTarget) {
+                outfile.open(preview_file, ios::binary);
+                if (!outfile.is_open()) throw runtime_error("Cannot open preview file.");
+                preview.export_bmp(outfile, verbose);
+                outfile.close();
+                if (verbose) cerr << "Preview written.\n";
+            }
+            if (statsTarget) {
+                write_metrics(metrics_file, filename[0], surfaces[0]->sizeX(), surfaces[0]->sizeY(), stats, (time1 - time0) * 0.001);
+                if (verbose) cerr << "Metrics written: RMS " << stats.rms() << ", maximum error " << stats.maximum << ", PSNR " << stats.psnr() << " dB.\n";
+            }
+        } catch(runtime_error e) {
+            cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    } else if (mode == ESTIMATE) {
         try {
+            double time0 = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
             infile.open(filename[0], ios::binary);
             if (!infile.is_open()) throw runtime_error("Cannot open input file.");
             pixmap.read_bmp(infile, verbose);
             infile.close();
+            double time1 = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+            estimate_dxt1(pixmap, (time1 - time0) * 0.001, sample_percent * 0.01, cout, verbose);
+        } catch(runtime_error e) {
+            cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    } else if (mode == DDS_TO_BMP) {
+        try {
+            // Block rows are decoded and written one at a time, so the whole image is never in memory.
+            infile.open(filename[0], ios::binary);
+            if (!infile.is_open()) throw runtime_error("Cannot open input file.");
             outfile.open(filename[1], ios::binary);
             if (!outfile.is_open()) throw runtime_error("Cannot open output file.");
-            double time0 = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-            pixmap.export_dxt1(outfile, verbose);
-            double time1 = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-            if (verbose) cerr << "Time taken: " << (time1 - time0) * 0.001 << " seconds.\n";
+            Pixmap::convert_dxt1_to_bmp(infile, outfile, verbose, level, surface);
             outfile.close();
+            infile.close();
         } catch(runtime_error e) {
             cerr << "Error: " << e.what() << "\n";
             return 1;
         }
     } else {
         try {
+            DxtImage image;
             infile.open(filename[0], ios::binary);
             if (!infile.is_open()) throw runtime_error("Cannot open input file.");
-            pixmap.read_dxt1(infile, verbose);
+            image.read_dds(infile, verbose);
             infile.close();
-            outfile.open(filename[1], ios::binary);
-            if (!outfile.is_open()) throw runtime_error("Cannot open output file.");
-            pixmap.export_bmp(outfile, verbose);
-            outfile.close();
+            for (auto& transform : transforms) transform(image);
+            if (tileX > 0 || tileY > 0) {
+                // Slice into tiles. Partial tiles at the right and bottom edges are written too.
+                if (tileX == 0 || tileY == 0) throw runtime_error("Tile size must be positive.");
+                for (int y = 0, row = 0; y < image.sizeY(); y += tileY, ++row) {
+                    for (int x = 0, column = 0; x < image.sizeX(); x += tileX, ++column) {
+                        DxtImage tile;
+                        tile.crop(image, x, y, min(tileX, image.sizeX() - x), min(tileY, image.sizeY() - y));
+                        outfile.open(tile_filename(filename[1], column, row), ios::binary);
+                        if (!outfile.is_open()) throw runtime_error("Cannot open output file.");
+                        tile.export_dds(outfile, verbose);
+                        outfile.close();
+                    }
+                }
+            } else {
+                outfile.open(filename[1], ios::binary);
+                if (!outfile.is_open()) throw runtime_error("Cannot open output file.");
+                image.export_dds(outfile, verbose);
+                outfile.close();
+            }
         } catch(runtime_error e) {
             cerr << "Error: " << e.what() << "\n";
             return 1;
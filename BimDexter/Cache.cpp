@@ -0,0 +1,311 @@
+// Cache.cpp
+
+#include <cstdio>
+#include <cerrno>
+#include <ctime>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <exception>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/utime.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <utime.h>
+#endif
+
+#include "Cache.h"
+#include "DdsHeader.h"
+#include "PixelBlock.h"
+#include "Common.h"
+
+using namespace std;
+using namespace std::chrono;
+
+
+// Name of the statistics file in the cache directory.
+const char* STATISTICS_FILE = "stats";
+
+// Name of the lock file in the cache directory.
+const char* LOCK_FILE = "lock";
+
+// Age in seconds after which a lock is assumed to be left behind by a crashed process.
+const int STALE_LOCK_SECONDS = 10;
+
+// Age in seconds after which a temporary file is assumed to be left behind by a crashed process.
+const int STALE_TEMPORARY_SECONDS = 3600;
+
+// After eviction, the entries take at most this fraction of the maximum size.
+const double EVICTION_TARGET = 0.9;
+
+
+// Returns true if the file name ends with the suffix.
+bool ends_with(string const& name, string const& suffix)
+{
+    return name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+// Returns the age of the file in seconds, or -1 if it does not exist.
+double file_age(string const& path)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return -1.0;
+    return difftime(time(nullptr), info.st_mtime);
+}
+
+
+// Sets the modification time of the file to now.
+void touch(string const& path)
+{
+#ifdef _WIN32
+    _utime(path.c_str(), nullptr);
+#else
+    utime(path.c_str(), nullptr);
+#endif
+}
+
+
+// Holds the lock of a cache directory while in scope. The lock is taken by creating
+// the lock file exclusively, which works between processes. If the lock cannot be
+// taken in a couple of seconds, locked() is false and the caller should skip its update.
+class CacheLock {
+
+  public:
+
+    CacheLock(string const& path) : path_(path), locked_(false)
+    {
+        for (int attempt = 0; attempt < 2000; ++attempt) {
+            auto file = fopen(path.c_str(), "wx");
+            if (file) {
+                fclose(file);
+                locked_ = true;
+                return;
+            }
+            if (attempt % 100 == 99 && file_age(path) > STALE_LOCK_SECONDS) remove(path.c_str());
+            this_thread::sleep_for(milliseconds(1));
+        }
+    }
+
+    ~CacheLock() { if (locked_) remove(path_.c_str()); }
+
+    bool locked() const { return locked_; }
+
+  private:
+
+    string path_;
+    bool locked_;
+
+}; // class CacheLock
+
+
+Cache::Cache(string const& directory, int maximum_size_mb) :
+    directory_(directory), maximumSize_((uint64_t)max(maximum_size_mb, 1) << 20)
+{
+    while (directory_.size() > 1 && (directory_.back() == '/' || directory_.back() == '\\')) directory_.pop_back();
+#ifdef _WIN32
+    auto result = _mkdir(directory_.c_str());
+#else
+    auto result = mkdir(directory_.c_str(), 0777);
+#endif
+    if (result != 0 && errno != EEXIST) throw runtime_error("Cannot create cache directory " + directory_ + ".");
+}
+
+
+string Cache::key(vector<Pixmap const*> const& surfaces, bool cubemap, bool mips)
+{
+    // Everything that affects the output goes into the hash. Keys of single images
+    // are the same as before texture arrays and cube maps were supported.
+    ostringstream options;
+    options << "BimDexter " << ENCODER_VERSION
+            << " size " << surfaces[0]->sizeX() << " " << surfaces[0]->sizeY();
+    if (surfaces.size() > 1 || cubemap) options << " surfaces " << surfaces.size() << " cube " << cubemap;
+    options
+            << " effort " << PixelBlock::effort
+            << " warm " << PixelBlock::warmStart
+            << " fixed " << PixelBlock::fixedPoint
+            << " refine " << PixelBlock::refinement
+            << " exact " << DxtPalette::exactEncoding
+            << " mips " << mips
+            << " importance " << hexfloat << DxtPalette::colorImportance.x << " "
+            << DxtPalette::colorImportance.y << " " << DxtPalette::colorImportance.z;
+
+    // 64-bit FNV-1a.
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto add = [&](uint8_t byte) { hash = (hash ^ byte) * 0x100000001b3ull; };
+
+    for (auto c : options.str()) add((uint8_t)c);
+    for (auto pixmap : surfaces) {
+        for (int y = 0; y < pixmap->sizeY(); ++y) {
+            for (int x = 0; x < pixmap->sizeX(); ++x) {
+                auto const& pixel = (*pixmap)(x, y);
+                add(pixel.r);
+                add(pixel.g);
+                add(pixel.b);
+            }
+        }
+    }
+
+    ostringstream key;
+    key << hex << setw(16) << setfill('0') << hash;
+    return key.str();
+}
+
+
+bool Cache::fetch(string const& key, ostream& s)
+{
+    ifstream entry(path(key), ios::binary);
+    if (!entry.is_open()) {
+        count(0, 1, 0);
+        return false;
+    }
+
+    // A damaged entry, for example one cut short by a full disk, is removed and counts
+    // as a miss. The entry must be exactly as long as its DDS header says.
+    bool valid = false;
+    try {
+        DdsHeader header;
+        header.read(entry);
+        entry.seekg(0, ios::end);
+        valid = entry && (uint64_t)entry.tellg() == header.fileSize();
+    } catch(runtime_error e) {
+    }
+    if (!valid) {
+        entry.close();
+        remove(path(key).c_str());
+        count(0, 1, 0);
+        return false;
+    }
+
+    entry.seekg(0, ios::beg);
+    s << entry.rdbuf();
+    entry.close();
+    touch(path(key));
+    count(1, 0, 0);
+    return true;
+}
+
+
+void Cache::insert(string const& key, string const& data)
+{
+    // Write a temporary file and rename it in place, so that readers never see
+    // a partial entry. A failure to insert is not an error; the entry is simply missing.
+    random_device device;
+    mt19937_64 random(device() ^ (uint64_t)steady_clock::now().time_since_epoch().count());
+    ostringstream temporary;
+    temporary << path(key) << "." << hex << random() << ".tmp";
+
+    {
+        ofstream s(temporary.str(), ios::binary);
+        if (!s.is_open()) return;
+        s.write(data.data(), data.size());
+        // Closing flushes the data, which can fail too.
+        s.close();
+        if (!s) {
+            remove(temporary.str().c_str());
+            return;
+        }
+    }
+
+    // If another process inserted the same entry first, the rename may fail on some
+    // platforms. The entries are identical so we can just drop ours.
+    if (rename(temporary.str().c_str(), path(key).c_str()) != 0) remove(temporary.str().c_str());
+
+    evict();
+}
+
+
+void Cache::count(int hits, int misses, int evictions)
+{
+    CacheLock lock(directory_ + "/" + LOCK_FILE);
+    if (!lock.locked()) return;
+
+    auto file = directory_ + "/" + STATISTICS_FILE;
+    uint64_t total[3] = { 0, 0, 0 };
+    {
+        ifstream s(file);
+        string name;
+        for (int i = 0; i < 3 && s >> name >> total[i]; ++i) {}
+    }
+    total[0] += hits;
+    total[1] += misses;
+    total[2] += evictions;
+
+    ofstream s(file);
+    s << "hits " << total[0] << "\nmisses " << total[1] << "\nevictions " << total[2] << "\n";
+}
+
+
+void Cache::evict()
+{
+    int evicted = 0;
+    {
+        CacheLock lock(directory_ + "/" + LOCK_FILE);
+        if (!lock.locked()) return;
+
+        vector<FileEntry> entries;
+        uint64_t total = 0;
+
+        for (auto& file : list_files(directory_)) {
+            if (ends_with(file.name, ".dds")) {
+                entries.push_back(file);
+                total += file.size;
+            } else if (ends_with(file.name, ".tmp") && difftime(time(nullptr), file.time) > STALE_TEMPORARY_SECONDS) {
+                remove((directory_ + "/" + file.name).c_str());
+            }
+        }
+
+        if (total <= maximumSize_) return;
+
+        // Oldest first. Times are the last use as fetch() touches the entries.
+        sort(entries.begin(), entries.end(), [](FileEntry const& a, FileEntry const& b) { return a.time < b.time; });
+
+        for (auto& entry : entries) {
+            if (total <= maximumSize_ * EVICTION_TARGET) break;
+            if (remove((directory_ + "/" + entry.name).c_str()) == 0) {
+                total -= entry.size;
+                ++evicted;
+            }
+        }
+    }
+    count(0, 0, evicted);
+}
+
+
+void Cache::print_statistics(ostream& s)
+{
+    uint64_t total[3] = { 0, 0, 0 };
+    {
+        ifstream stats(directory_ + "/" + STATISTICS_FILE);
+        string name;
+        for (int i = 0; i < 3 && stats >> name >> total[i]; ++i) {}
+    }
+
+    int entries = 0;
+    uint64_t size = 0;
+    for (auto& file : list_files(directory_)) {
+        if (!ends_with(file.name, ".dds")) continue;
+        ++entries;
+        size += file.size;
+    }
+
+    auto lookups = total[0] + total[1];
+    s << "Cache directory: " << directory_ << "\n"
+      << "Hits:            " << total[0] << "\n"
+      << "Misses:          " << total[1] << "\n"
+      << "Hit rate:        " << fixed << setprecision(1) << (lookups > 0 ? 100.0 * total[0] / lookups : 0.0) << "%\n"
+      << "Evictions:       " << total[2] << "\n"
+      << "Entries:         " << entries << "\n"
+      << "Size:            " << setprecision(1) << size / 1048576.0 << " MB of " << maximumSize_ / 1048576.0 << " MB\n";
+}
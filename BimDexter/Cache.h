@@ -0,0 +1,73 @@
+// Cache.h
+// Persistent on-disk cache of compressed images.
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "Pixmap.h"
+
+using namespace std;
+
+
+// A directory of compressed DDS files keyed by a hash of the input pixels, the encoder
+// version and the encoder options. Entries are inserted atomically by renaming a
+// temporary file, so any number of processes may share a cache directory. When the
+// total size of the entries exceeds the maximum, least recently used entries are evicted.
+// Hit and miss counts are kept in the directory.
+class Cache {
+
+  public:
+
+    // Version of the compressed output. Change this whenever the encoder output changes
+    // for the same input and options, so that old entries are no longer found.
+    static const int ENCODER_VERSION = 7;
+
+    // Default maximum total size of the entries in megabytes.
+    static const int DEFAULT_SIZE_MB = 1024;
+
+    // Opens the cache directory, creating it if it does not exist.
+    // Throws runtime_error if the directory cannot be used.
+    Cache(string const& directory, int maximum_size_mb = DEFAULT_SIZE_MB);
+
+    // Returns the key of compressing the surfaces (see Pixmap::export_dxt1) with the current
+    // encoder settings. Only settings that affect the output are included (the number of
+    // threads is not).
+    static string key(vector<Pixmap const*> const& surfaces, bool cubemap, bool mips);
+
+    // Looks up the key. On a hit, the stored DDS data is written to the stream and
+    // the entry is marked as recently used. An entry whose length does not match its
+    // DDS header is removed and counts as a miss. Records the hit or miss.
+    bool fetch(string const& key, ostream& s);
+
+    // Inserts DDS data under the key and evicts entries if the cache is too large. The data
+    // is written to a temporary file that is renamed into place, so partial entries are
+    // never visible.
+    void insert(string const& key, string const& data);
+
+    // Writes hit and miss counts, the number of entries and their total size.
+    void print_statistics(ostream& s);
+
+  private:
+
+    // Path of the entry file of a key.
+    string path(string const& key) const { return directory_ + "/" + key + ".dds"; }
+
+    // Adds to the hit, miss and eviction counts in the statistics file.
+    void count(int hits, int misses, int evictions);
+
+    // Removes least recently used entries until the total size is below the maximum.
+    void evict();
+
+    string directory_;
+
+    uint64_t maximumSize_;
+
+}; // class Cache
+
+
+#endif // CACHE_H
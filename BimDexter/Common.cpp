@@ -1,8 +1,19 @@
 // Common.cpp
 
+#include <cstdio>
 #include <fstream>
 #include <cstdint>
 
+#ifdef _WIN32
+#include <io.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
 #include "Common.h"
 
 using namespace std;
@@ -48,3 +59,67 @@ void write_32_le(ostream& s, uint32_t x)
     buf[3] = (char)(x >> 24);
     s.write(buf, 4);
 }
+
+
+vector<FileEntry> list_files(string const& directory)
+{
+    vector<FileEntry> files;
+#ifdef _WIN32
+    _finddata64_t data;
+    auto handle = _findfirst64((directory + "/*").c_str(), &data);
+    if (handle == -1) return files;
+    do {
+        if (!(data.attrib & _A_SUBDIR)) files.push_back({ data.name, (uint64_t)data.size, (time_t)data.time_write });
+    } while (_findnext64(handle, &data) == 0);
+    _findclose(handle);
+#else
+    auto dir = opendir(directory.c_str());
+    if (!dir) return files;
+    while (auto entry = readdir(dir)) {
+        struct stat info;
+        string name = entry->d_name;
+        if (stat((directory + "/" + name).c_str(), &info) == 0 && S_ISREG(info.st_mode))
+            files.push_back({ name, (uint64_t)info.st_size, info.st_mtime });
+    }
+    closedir(dir);
+#endif
+    return files;
+}
+
+
+bool is_directory(string const& path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && (info.st_mode & S_IFMT) == S_IFDIR;
+}
+
+
+string json_string(string const& text)
+{
+    string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if ((unsigned char)c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", (unsigned)c);
+            quoted += escape;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+
+string csv_field(string const& text)
+{
+    if (text.find_first_of(",\"\r\n") == string::npos) return text;
+    string quoted = "\"";
+    for (char c : text) {
+        if (c == '"') quoted += '"';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
@@ -6,6 +6,9 @@
 
 #include <fstream>
 #include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
 
 using namespace std;
 
@@ -30,5 +33,42 @@ void write_16_le(ostream&, uint16_t x);
 // Writes 4 little-endian bytes.
 void write_32_le(ostream&, uint32_t x);
 
+// Stores 2 little-endian bytes in memory.
+inline void store_16_le(uint8_t* p, uint16_t x)
+{
+    p[0] = (uint8_t)x;
+    p[1] = (uint8_t)(x >> 8);
+}
+
+// Stores 4 little-endian bytes in memory.
+inline void store_32_le(uint8_t* p, uint32_t x)
+{
+    p[0] = (uint8_t)x;
+    p[1] = (uint8_t)(x >> 8);
+    p[2] = (uint8_t)(x >> 16);
+    p[3] = (uint8_t)(x >> 24);
+}
+
+// A regular file in a directory.
+struct FileEntry {
+    string name;
+    uint64_t size;
+    time_t time;
+};
+
+// Lists the regular files in the directory with their sizes and modification times.
+// Returns an empty list if the directory cannot be read.
+vector<FileEntry> list_files(string const& directory);
+
+// Returns true if the path is a directory.
+bool is_directory(string const& path);
+
+// Returns the text as a quoted JSON string, escaping quotes, backslashes and control characters.
+string json_string(string const& text);
+
+// Returns the text as a CSV field. Fields with commas, quotes or line breaks are quoted,
+// with quotes doubled.
+string csv_field(string const& text);
+
 
 #endif // COMMON_H
@@ -0,0 +1,134 @@
+// DdsHeader.cpp
+
+#include <exception>
+#include <stdexcept>
+
+#include "DdsHeader.h"
+#include "Common.h"
+
+using namespace std;
+
+
+void DdsHeader::read(istream& s)
+{
+    auto filetype = read_32_le(s);
+    if (filetype != ' SDD') throw runtime_error("DDS filetype header not found.");
+    // Header length.
+    int headerLength = read_32_le(s);
+    if (headerLength != 124) throw runtime_error("Invalid DDS header length.");
+    auto flags = read_32_le(s);
+    height = read_32_le(s);
+    width = read_32_le(s);
+    if (width <= 0 || height <= 0) throw runtime_error("Invalid DDS image size.");
+    if (width & 3) throw runtime_error("DDS image width must be divisible by 4.");
+    if (height & 3) throw runtime_error("DDS image height must be divisible by 4.");
+    int linearSize = read_32_le(s);
+    int depth = read_32_le(s);
+    auto mipmaps = read_32_le(s);
+    // Files without mipmaps may store 0 or 1 here.
+    if (!(flags & 0x20000) || mipmaps < 1) mipmaps = 1;
+    if (mipmaps > (uint32_t)fullMipmapCount()) throw runtime_error("DDS file has more mipmap levels than its size allows.");
+    mipmapCount = (int)mipmaps;
+    s.seekg(4 * 11, ios::cur);
+    int formatHeaderLength = read_32_le(s);
+    int dwFlags = read_32_le(s);
+    if (dwFlags != 4) throw runtime_error("Only compressed non-alpha RGB files supported.");
+    int fourcc = read_32_le(s);
+    if (fourcc != '1TXD' && fourcc != '01XD') throw runtime_error("Only DXT1 compressed files supported.");
+    s.seekg(4 * 5, ios::cur);
+    int content = read_32_le(s);
+    if (!(content & 0x1000)) throw runtime_error("DDS file content must be texture.");
+    int caps2 = read_32_le(s);
+    s.seekg(4 * 3, ios::cur);
+
+    // DDSCAPS2_CUBEMAP. Cube maps must have all 6 faces.
+    cubemap = (caps2 & 0x200) != 0;
+    if (cubemap && (caps2 & 0xfc00) != 0xfc00) throw runtime_error("Only cube maps with all faces are supported.");
+    arraySize = 1;
+    extendedHeader = fourcc == '01XD';
+
+    if (extendedHeader) {
+        // DXGI format, resource dimension, misc flags, array size, misc flags 2.
+        int format = read_32_le(s);
+        if (format < 70 || format > 72) throw runtime_error("Only DXT1 (BC1) compressed files supported.");
+        int dimension = read_32_le(s);
+        if (dimension != 3) throw runtime_error("Only 2D textures are supported.");
+        int miscFlags = read_32_le(s);
+        // DDS_RESOURCE_MISC_TEXTURECUBE.
+        cubemap = (miscFlags & 0x4) != 0;
+        auto elements = read_32_le(s);
+        if (elements > MAX_ARRAY_SIZE) throw runtime_error("DDS texture arrays can have at most " + to_string(MAX_ARRAY_SIZE) + " elements.");
+        arraySize = max(1, (int)elements);
+        s.seekg(4, ios::cur);
+    }
+    if (cubemap && width != height) throw runtime_error("Cube map faces must be square.");
+
+    // The surfaces must fit in the rest of the file, if its length is known.
+    auto position = s.tellg();
+    if (position >= 0) {
+        s.seekg(0, ios::end);
+        auto end = s.tellg();
+        s.seekg(position);
+        if (end < position || (uint64_t)surfaceCount() > (uint64_t)(end - position) / surfaceSize())
+            throw runtime_error("DDS file is shorter than its surfaces.");
+    }
+}
+
+
+void DdsHeader::write(ostream& s) const
+{
+    write_32_le(s, ' SDD');
+    // Header length.
+    write_32_le(s, 124);
+    // Data flags (CAPS, HEIGHT, WIDTH, PIXELFORMAT, LINEARSIZE, and MIPMAPCOUNT if there are mipmaps).
+    write_32_le(s, 0x1 + 0x2 + 0x4 + 0x1000 + 0x80000 + (mipmapCount > 1 ? 0x20000 : 0));
+    write_32_le(s, height);
+    write_32_le(s, width);
+    // PitchOrLinearSize, Depth, MipMapCount, dwReserved[11].
+    // The field is 32 bits; readers compute the size from the dimensions.
+    write_32_le(s, (uint32_t)linearSize());
+    write_32_le(s, 0);
+    write_32_le(s, mipmapCount > 1 ? mipmapCount : 0);
+    for (int i = 0; i < 11; ++i) write_32_le(s, 0);
+    // Pixel format: dwSize, dwFlags, dwFourCC, dwRGBBitCount, dw[R, G, B, A]BitMask.
+    write_32_le(s, 32);
+    write_32_le(s, 0x4); // DDPF_FOURCC
+    write_32_le(s, extended() ? '01XD' : '1TXD');
+    write_32_le(s, 0);
+    write_32_le(s, 0xff0000); 
+    write_32_le(s, 0x00ff00);
+    write_32_le(s, 0x0000ff);
+    write_32_le(s, 0);
+    // dwCaps, dwCaps[2..4], dwReserved2.
+    bool complex = mipmapCount > 1 || surfaceCount() > 1;
+    write_32_le(s, 0x1000 + (complex ? 0x8 : 0) + (mipmapCount > 1 ? 0x400000 : 0)); // DDSCAPS_TEXTURE (+ COMPLEX, MIPMAP)
+    write_32_le(s, cubemap ? 0x200 + 0xfc00 : 0); // DDSCAPS2_CUBEMAP and all faces
+    write_32_le(s, 0);
+    write_32_le(s, 0);
+    write_32_le(s, 0);
+
+    if (extended()) {
+        // DXGI_FORMAT_BC1_UNORM, DDS_DIMENSION_TEXTURE2D, misc flags (TEXTURECUBE), array size, misc flags 2.
+        write_32_le(s, 71);
+        write_32_le(s, 3);
+        write_32_le(s, cubemap ? 0x4 : 0);
+        write_32_le(s, arraySize);
+        write_32_le(s, 0);
+    }
+}
+
+
+size_t DdsHeader::surfaceSize() const
+{
+    size_t size = 0;
+    for (int level = 0; level < mipmapCount; ++level) size += levelSize(level);
+    return size;
+}
+
+
+int DdsHeader::fullMipmapCount() const
+{
+    int count = 1;
+    while ((width >> count) > 0 || (height >> count) > 0) ++count;
+    return count;
+}
@@ -0,0 +1,82 @@
+// DdsHeader.h
+// DDS file header for DXT1 textures, texture arrays and cube maps.
+
+#ifndef DDSHEADER_H
+#define DDSHEADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <algorithm>
+
+using namespace std;
+
+
+// The parts of a DDS file header that are relevant to DXT1 textures. A file holds one or more
+// surfaces of the same size, each followed by its mipmap levels. Texture arrays are written
+// with the DX10 extended header. Cube maps have 6 faces per array element in the order
+// +X, -X, +Y, -Y, +Z, -Z; a single cube map is written with the legacy header.
+struct DdsHeader {
+
+    // Largest number of array elements, as in Direct3D 11.
+    static const uint32_t MAX_ARRAY_SIZE = 2048;
+
+    // Image width in pixels.
+    int width;
+    // Image height in pixels.
+    int height;
+    // Number of mipmap levels, including the full size image.
+    int mipmapCount;
+    // Number of array elements.
+    int arraySize;
+    // Whether each array element is a cube map.
+    bool cubemap;
+    // Whether the DX10 extended header was read. It is always written for arrays.
+    bool extendedHeader;
+
+    DdsHeader() : width(0), height(0), mipmapCount(1), arraySize(1), cubemap(false), extendedHeader(false) {}
+    DdsHeader(int width, int height, int mipmapCount = 1) :
+        width(width), height(height), mipmapCount(mipmapCount), arraySize(1), cubemap(false), extendedHeader(false) {}
+
+    // Whether the file has the DX10 extended header.
+    bool extended() const { return extendedHeader || arraySize > 1; }
+
+    // Size of the header in bytes, including the magic number and the extended header.
+    int headerSize() const { return extended() ? 148 : 128; }
+
+    // Number of surfaces: array elements times cube map faces.
+    int surfaceCount() const { return arraySize * (cubemap ? 6 : 1); }
+
+    // Size of the DXT1 block data of the full size image in bytes.
+    size_t linearSize() const { return levelSize(0); }
+
+    // Width of a mipmap level in pixels.
+    int levelWidth(int level) const { return max(1, width >> level); }
+
+    // Height of a mipmap level in pixels.
+    int levelHeight(int level) const { return max(1, height >> level); }
+
+    // Size of the DXT1 block data of a mipmap level in bytes. Levels are padded to whole blocks.
+    size_t levelSize(int level) const { return (size_t)((levelWidth(level) + 3) / 4) * ((levelHeight(level) + 3) / 4) * 8; }
+
+    // Size of the DXT1 block data of all mipmap levels of a surface in bytes.
+    size_t surfaceSize() const;
+
+    // Size of the file in bytes.
+    size_t fileSize() const { return headerSize() + surfaceCount() * surfaceSize(); }
+
+    // Number of mipmap levels in a full chain down to 1x1 pixels.
+    int fullMipmapCount() const;
+
+    // Reads the header, including the magic number and the extended header. Throws
+    // runtime_error if the file is not a supported DXT1 DDS file, or if the stream is
+    // seekable and shorter than the surfaces the header describes.
+    void read(istream& s);
+
+    // Writes the header, including the magic number.
+    void write(ostream& s) const;
+
+}; // struct DdsHeader
+
+
+#endif // DDSHEADER_H
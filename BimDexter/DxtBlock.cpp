@@ -1,5 +1,7 @@
 // DxtBlock.cpp
 
+#include <algorithm>
+
 #include "DxtBlock.h"
 #include "Common.h"
 
@@ -26,23 +28,322 @@ Pixel decode_565(uint16_t color)
 
 
 void DxtBlock::decode(Pixmap& pixmap, int x0, int y0)
+{
+    Pixel pixels[SIZE * SIZE];
+    decode(pixels);
+
+    // Blocks are encoded upside down. We flip them here.
+    for(int y = SIZE - 1, i = 0; y >= 0; --y) {
+        for(int x = 0; x < SIZE; ++x, ++i) {
+            if (x0 + x < pixmap.sizeX() && y0 + y >= 0 && y0 + y < pixmap.sizeY())
+                pixmap(x0 + x, y0 + y) = pixels[i];
+        }
+    }
+}
+
+
+void DxtBlock::decode_palette(Pixel* colors) const
+{
+    colors[0] = decode_565(color0);
+    colors[1] = decode_565(color1);
+    colors[2] = Pixel::interpolate(colors[0], 2, colors[1], 1);
+    colors[3] = Pixel::interpolate(colors[0], 1, colors[1], 2);
+}
+
+
+void DxtBlock::decode(Pixel* pixels) const
 {
     Pixel color[4];
-    color[0] = decode_565(color0);
-    color[1] = decode_565(color1);
-    color[2] = Pixel::interpolate(color[0], 2, color[1], 1);
-    color[3] = Pixel::interpolate(color[0], 1, color[1], 2);
+    decode_palette(color);
 
     uint32_t b = bitmap;
 
-    // Blocks are encoded upside down. We flip them here.
-    for(int y = SIZE - 1; y >= 0; --y) {
-        for(int x = 0; x < SIZE; ++x) {
-            pixmap(x0 + x, y0 + y) = color[b & 3];
-            b >>= 2;
+    for (int i = 0; i < SIZE * SIZE; ++i) {
+        pixels[i] = color[b & 3];
+        b >>= 2;
+    }
+}
+
+
+// Finds 5- or 6-bit codes v0 and v1 of one color component such that the component of
+// each palette position (color 0, color 2, color 3, color 1) equals its target.
+// Targets of -1 are free. Returns false if there are no such codes.
+bool solve_component(int bits, int const* target, int& v0, int& v1)
+{
+    int codes = 1 << bits;
+    auto decode = [bits](int v) { return bits == 5 ? (v << 3) + (v >> 2) : (v << 2) + (v >> 4); };
+    // Returns the code of an 8-bit value, or -1 if the value cannot be represented.
+    auto inverse = [&](int x) { return x >= 0 && x < 256 && decode(x >> (8 - bits)) == x ? x >> (8 - bits) : -1; };
+
+    // Pixel::interpolate truncates, so color 2 = (2 p0 + p1) / 3 leaves 3 candidates for p1
+    // and color 3 = (p0 + 2 p1) / 3 leaves at most 2.
+    for (int a = target[0] >= 0 ? inverse(target[0]) : 0; a >= 0 && a < codes; ++a) {
+        int p0 = decode(a);
+        int candidates[3];
+        int count = 0;
+        if (target[3] >= 0) {
+            candidates[count++] = inverse(target[3]);
+        } else if (target[1] >= 0) {
+            for (int p1 = 3 * target[1] - 2 * p0; p1 < 3 * target[1] - 2 * p0 + 3; ++p1) candidates[count++] = inverse(p1);
+        } else if (target[2] >= 0) {
+            for (int p1 = (3 * target[2] - p0 + 1) / 2; 2 * p1 < 3 * target[2] - p0 + 3; ++p1) candidates[count++] = inverse(p1);
+        } else {
+            candidates[count++] = a;
+        }
+        for (int i = 0; i < count; ++i) {
+            int b = candidates[i];
+            if (b < 0) continue;
+            int p1 = decode(b);
+            if (target[1] >= 0 && (2 * p0 + p1) / 3 != target[1]) continue;
+            if (target[2] >= 0 && (p0 + 2 * p1) / 3 != target[2]) continue;
+            v0 = a;
+            v1 = b;
+            return true;
+        }
+        if (target[0] >= 0) break;
+    }
+    return false;
+}
+
+
+bool DxtBlock::recover(Pixel const* pixels)
+{
+    // A block has at most 4 distinct colors.
+    Pixel distinct[4];
+    int index[SIZE * SIZE];
+    int count = 0;
+
+    for (int i = 0; i < SIZE * SIZE; ++i) {
+        auto const& p = pixels[i];
+        int j = 0;
+        while (j < count && (distinct[j].r != p.r || distinct[j].g != p.g || distinct[j].b != p.b)) ++j;
+        if (j == count) {
+            if (count == 4) return false;
+            distinct[count++] = p;
+        }
+        index[i] = j;
+    }
+
+    auto component = [](Pixel const& p, int c) { return c == 0 ? (int)p.r : c == 1 ? (int)p.g : (int)p.b; };
+
+    // Palette colors lie on a line in the order color 0, color 2, color 3, color 1.
+    // Sort the distinct colors along the line through the two farthest apart.
+    int order[4] = { 0, 1, 2, 3 };
+    int key[4] = { 0, 0, 0, 0 };
+    if (count > 2) {
+        int a = 0, b = 1, farthest = -1;
+        for (int i = 0; i < count; ++i) {
+            for (int j = i + 1; j < count; ++j) {
+                int d = 0;
+                for (int c = 0; c < 3; ++c) d += (component(distinct[i], c) - component(distinct[j], c)) * (component(distinct[i], c) - component(distinct[j], c));
+                if (d > farthest) { farthest = d; a = i; b = j; }
+            }
+        }
+        for (int i = 0; i < count; ++i)
+            for (int c = 0; c < 3; ++c)
+                key[i] += (component(distinct[i], c) - component(distinct[a], c)) * (component(distinct[b], c) - component(distinct[a], c));
+        sort(order, order + count, [&](int i, int j) { return key[i] < key[j]; });
+    }
+
+    // Palette index of each position along the line.
+    static const int positionColor[4] { 0, 2, 3, 1 };
+
+    // Try each order preserving choice of positions for the distinct colors.
+    for (int positions = 0; positions < 16; ++positions) {
+        int chosen[4];
+        int n = 0;
+        for (int k = 0; k < 4; ++k)
+            if (positions & (1 << k)) {
+                if (n == count) { n = -1; break; }
+                chosen[n++] = k;
+            }
+        if (n != count) continue;
+
+        int colorOf[4];
+        for (int i = 0; i < count; ++i) colorOf[order[i]] = positionColor[chosen[i]];
+
+        int v0[3], v1[3];
+        bool solved = true;
+        for (int c = 0; c < 3 && solved; ++c) {
+            int target[4] = { -1, -1, -1, -1 };
+            for (int i = 0; i < count; ++i) target[colorOf[i] == 0 ? 0 : colorOf[i] == 2 ? 1 : colorOf[i] == 3 ? 2 : 3] = component(distinct[i], c);
+            solved = solve_component(c == 1 ? 6 : 5, target, v0[c], v1[c]);
+        }
+        if (!solved) continue;
+
+        color0 = (uint16_t)((v0[2] << 11) | (v0[1] << 5) | v0[0]);
+        color1 = (uint16_t)((v1[2] << 11) | (v1[1] << 5) | v1[0]);
+        bitmap = 0;
+        for (int i = 0; i < SIZE * SIZE; ++i) bitmap |= (uint32_t)colorOf[index[i]] << (i * 2);
+
+        if (color0 == color1) {
+            // A single color. The compressor writes these with color1 = 0.
+            color1 = 0;
+            bitmap = 0;
+        } else if (color0 < color1) {
+            // Swapping the colors swaps palette indices 0 and 1, and 2 and 3.
+            swap(color0, color1);
+            bitmap ^= 0x55555555;
         }
+
+        // Interpolation is not exactly linear, so we check the result.
+        Pixel decoded[SIZE * SIZE];
+        decode(decoded);
+        bool exact = true;
+        for (int i = 0; i < SIZE * SIZE && exact; ++i)
+            exact = decoded[i].r == pixels[i].r && decoded[i].g == pixels[i].g && decoded[i].b == pixels[i].b;
+        if (exact) return true;
     }
 
+    return false;
+}
+
+
+int DxtBlock::error(Pixel const* pixels, int const* weight) const
+{
+    Pixel decoded[SIZE * SIZE];
+    decode(decoded);
+
+    int error = 0;
+    for (int i = 0; i < SIZE * SIZE; ++i) {
+        int dr = decoded[i].r - pixels[i].r;
+        int dg = decoded[i].g - pixels[i].g;
+        int db = decoded[i].b - pixels[i].b;
+        error += weight[0] * dr * dr + weight[1] * dg * dg + weight[2] * db * db;
+    }
+    return error;
+}
+
+
+int DxtBlock::refine(Pixel const* pixels, int const* weight, int max_sweeps)
+{
+    const int N = SIZE * SIZE;
+    static const int bits[3] { 5, 6, 5 };
+    auto decode = [](int v, int bits) { return bits == 5 ? (v << 3) + (v >> 2) : (v << 2) + (v >> 4); };
+
+    // Fills in the decoded component of each palette color. Components are independent.
+    auto palette = [&](int c, int v0, int v1, int* value) {
+        value[0] = decode(v0, bits[c]);
+        value[1] = decode(v1, bits[c]);
+        value[2] = (2 * value[0] + value[1]) / 3;
+        value[3] = (value[0] + 2 * value[1]) / 3;
+    };
+
+    int code[2][3] {
+        { color0 & 0x1f, (color0 >> 5) & 0x3f, color0 >> 11 },
+        { color1 & 0x1f, (color1 >> 5) & 0x3f, color1 >> 11 },
+    };
+
+    float pixel[3][N];
+    for (int i = 0; i < N; ++i) {
+        pixel[0][i] = pixels[i].r;
+        pixel[1][i] = pixels[i].g;
+        pixel[2][i] = pixels[i].b;
+    }
+
+    // Error of each component and of the whole pixel for each palette color. A move changes
+    // one component, so a candidate is evaluated by swapping in its component errors, and
+    // the new palette indices are the minima of the updated totals. The arrays are laid out
+    // so that the pixel loops vectorize. Errors are stored in floating point because
+    // vector integer multiplication is slow, but all values are integers below 2^24,
+    // so the arithmetic is exact and the results do not depend on the compiler.
+    float term[3][4][N];
+    float total[4][N];
+
+    // Computes the component errors of the palette values into the array.
+    auto component_error = [&](int c, int const* value, float (*error)[N]) {
+        for (int j = 0; j < 4; ++j) {
+            for (int i = 0; i < N; ++i) {
+                float d = (float)value[j] - pixel[c][i];
+                error[j][i] = (float)weight[c] * d * d;
+            }
+        }
+    };
+
+    for (int c = 0; c < 3; ++c) {
+        int value[4];
+        palette(c, code[0][c], code[1][c], value);
+        component_error(c, value, term[c]);
+    }
+    for (int j = 0; j < 4; ++j)
+        for (int i = 0; i < N; ++i) total[j][i] = term[0][j][i] + term[1][j][i] + term[2][j][i];
+
+    int error = 0;
+    for (int i = 0; i < N; ++i) error += (int)min(min(total[0][i], total[1][i]), min(total[2][i], total[3][i]));
+
+    for (int sweep = 0; sweep < max_sweeps; ++sweep) {
+        int best_error = error;
+        int best_c = -1, best_v0 = 0, best_v1 = 0;
+
+        for (int c = 0; c < 3; ++c) {
+            int maximum = (1 << bits[c]) - 1;
+            for (int d0 = -1; d0 <= 1; ++d0) {
+                for (int d1 = -1; d1 <= 1; ++d1) {
+                    int v0 = code[0][c] + d0;
+                    int v1 = code[1][c] + d1;
+                    if ((d0 == 0) == (d1 == 0) || v0 < 0 || v0 > maximum || v1 < 0 || v1 > maximum) continue;
+                    int value[4];
+                    palette(c, v0, v1, value);
+                    float candidate[4][N];
+                    component_error(c, value, candidate);
+                    int candidate_error = 0;
+                    for (int i = 0; i < N; ++i) {
+                        float e0 = total[0][i] - term[c][0][i] + candidate[0][i];
+                        float e1 = total[1][i] - term[c][1][i] + candidate[1][i];
+                        float e2 = total[2][i] - term[c][2][i] + candidate[2][i];
+                        float e3 = total[3][i] - term[c][3][i] + candidate[3][i];
+                        candidate_error += (int)min(min(e0, e1), min(e2, e3));
+                    }
+                    if (candidate_error < best_error) {
+                        best_error = candidate_error;
+                        best_c = c;
+                        best_v0 = v0;
+                        best_v1 = v1;
+                    }
+                }
+            }
+        }
+
+        if (best_c < 0) break;
+
+        // Apply the move.
+        int c = best_c;
+        code[0][c] = best_v0;
+        code[1][c] = best_v1;
+        int value[4];
+        palette(c, best_v0, best_v1, value);
+        float candidate[4][N];
+        component_error(c, value, candidate);
+        for (int j = 0; j < 4; ++j) {
+            for (int i = 0; i < N; ++i) {
+                total[j][i] += candidate[j][i] - term[c][j][i];
+                term[c][j][i] = candidate[j][i];
+            }
+        }
+        error = best_error;
+    }
+
+    color0 = (uint16_t)((code[0][2] << 11) | (code[0][1] << 5) | code[0][0]);
+    color1 = (uint16_t)((code[1][2] << 11) | (code[1][1] << 5) | code[1][0]);
+    bitmap = 0;
+
+    for (int i = 0; i < N; ++i) {
+        int nearest = 0;
+        for (int j = 1; j < 4; ++j)
+            if (total[j][i] < total[nearest][i]) nearest = j;
+        bitmap |= (uint32_t)nearest << (i * 2);
+    }
+
+    // DXT1 specifies that color0 > color1 for the block to be interpreted as a non-alpha
+    // encoding. Swapping the colors swaps palette indices 0 and 1, and 2 and 3.
+    if (color0 < color1) {
+        swap(color0, color1);
+        bitmap ^= 0x55555555;
+    } else if (color0 == color1) {
+        bitmap = 0;
+    }
+
+    return error;
 }
 
 
@@ -54,9 +355,46 @@ void DxtBlock::read(istream& s)
 }
 
 
-void DxtBlock::write(ostream& s)
+void DxtBlock::write(ostream& s) const
 {
     write_16_le(s, color0);
     write_16_le(s, color1);
     write_32_le(s, bitmap);
 }
+
+
+void DxtBlock::store(uint8_t* p) const
+{
+    store_16_le(p, color0);
+    store_16_le(p + 2, color1);
+    store_32_le(p + 4, bitmap);
+}
+
+
+void DxtBlock::flip_x()
+{
+    // Each byte holds a row. Reverse the order of the 2-bit pixels within each byte.
+    bitmap = ((bitmap >> 4) & 0x0f0f0f0f) | ((bitmap & 0x0f0f0f0f) << 4);
+    bitmap = ((bitmap >> 2) & 0x33333333) | ((bitmap & 0x33333333) << 2);
+}
+
+
+void DxtBlock::flip_y()
+{
+    // Reverse the order of the rows.
+    bitmap = (bitmap >> 24) | ((bitmap >> 8) & 0xff00) | ((bitmap << 8) & 0xff0000) | (bitmap << 24);
+}
+
+
+void DxtBlock::transpose()
+{
+    uint32_t b = 0;
+
+    for (int y = 0; y < SIZE; ++y) {
+        for (int x = 0; x < SIZE; ++x) {
+            b |= ((bitmap >> ((y * SIZE + x) * 2)) & 3) << ((x * SIZE + y) * 2);
+        }
+    }
+
+    bitmap = b;
+}
@@ -24,13 +24,52 @@ struct DxtBlock {
   uint32_t bitmap;
 
   // Decodes this block and places it into the pixmap with the upper left corner at the given coordinates.
+  // Pixels that fall outside the pixmap are discarded.
   void decode(Pixmap& pixmap, int x0, int y0);
 
+  // Decodes this block into 16 pixels in bitmap order, that is, row major from the top row.
+  void decode(Pixel* pixels) const;
+
+  // Decodes the 4 palette colors of this block.
+  void decode_palette(Pixel* colors) const;
+
+  // Checks whether the 16 pixels, given in bitmap order, are the decoded result of some
+  // DXT1 block, as happens with images that were DXT1 compressed before. If so, sets this
+  // block to an encoding that decodes to exactly the same pixels and returns true.
+  // Colors are ordered so that color0 > color1, except that blocks of a single color
+  // are encoded like constant blocks are by the compressor, with color1 = 0 and bitmap = 0.
+  // If a palette color is not used by any pixel, it may come out different from the
+  // original block.
+  bool recover(Pixel const* pixels);
+
+  // Searches the 565 lattice around color0 and color1 for the pair of colors that minimizes
+  // the weighted squared error of the decoded block against the 16 pixels, given in bitmap
+  // order. Each sweep tries moving one of the colors by one step in one component and
+  // takes the best improving move. Pixel colors are chosen by exhaustive search. Weights
+  // are integer color component importances in [0, 16]. Returns the final error.
+  int refine(Pixel const* pixels, int const* weight, int max_sweeps);
+
+  // Returns the weighted squared error of the decoded block against the 16 pixels, given
+  // in bitmap order, with integer weights as in refine. This is the error refine returns.
+  int error(Pixel const* pixels, int const* weight) const;
+
   // Reads this block from the stream.
   void read(istream& s);
 
   // Writes this block to the stream.
-  void write(ostream& s);
+  void write(ostream& s) const;
+
+  // Stores this block in memory in file format, which takes 8 bytes.
+  void store(uint8_t* p) const;
+
+  // Mirrors the block horizontally.
+  void flip_x();
+
+  // Mirrors the block vertically.
+  void flip_y();
+
+  // Swaps the X and Y axes of the block.
+  void transpose();
 
 }; // struct DxtBlock
 
@@ -0,0 +1,121 @@
+// DxtImage.cpp
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <iostream>
+
+#include "DxtImage.h"
+#include "DdsHeader.h"
+#include "Common.h"
+
+using namespace std;
+
+
+void DxtImage::resize(int blocksX, int blocksY)
+{
+    blocksX_ = blocksX;
+    blocksY_ = blocksY;
+    data_.resize((size_t)blocksX * blocksY);
+}
+
+
+void DxtImage::read_dds(istream& s, bool verbose)
+{
+    DdsHeader header;
+    header.read(s);
+    if (header.surfaceCount() > 1) throw runtime_error("Transforms only support DDS files with one surface.");
+    if (header.mipmapCount > 1) throw runtime_error("Transforms do not support DDS files with mipmaps.");
+
+    if (verbose) cerr << "Reading " << header.width << "x" << header.height << " DDS image.\n";
+
+    resize(header.width / DxtBlock::SIZE, header.height / DxtBlock::SIZE);
+    read(s);
+
+    if (!s) throw runtime_error("Unexpected end of DDS file.");
+}
+
+
+void DxtImage::export_dds(ostream& s, bool verbose)
+{
+    DdsHeader(sizeX(), sizeY()).write(s);
+    write(s);
+
+    if (verbose) cerr << "DDS image written (" << sizeX() << "x" << sizeY() << ").\n";
+}
+
+
+void DxtImage::read(istream& s)
+{
+    for (auto& block : data_) block.read(s);
+}
+
+
+void DxtImage::write(ostream& s) const
+{
+    for (auto& block : data_) block.write(s);
+}
+
+
+void DxtImage::flip_x()
+{
+    for (int y = 0; y < blocksY_; ++y) {
+        reverse(data_.begin() + offset(0, y), data_.begin() + offset(0, y + 1));
+    }
+    for (auto& block : data_) block.flip_x();
+}
+
+
+void DxtImage::flip_y()
+{
+    for (int y = 0; y < blocksY_ / 2; ++y) {
+        swap_ranges(data_.begin() + offset(0, y), data_.begin() + offset(0, y + 1), data_.begin() + offset(0, blocksY_ - 1 - y));
+    }
+    for (auto& block : data_) block.flip_y();
+}
+
+
+void DxtImage::transpose()
+{
+    vector<DxtBlock> data(data_.size());
+
+    for (int y = 0; y < blocksY_; ++y) {
+        for (int x = 0; x < blocksX_; ++x) {
+            auto& block = data[x * blocksY_ + y];
+            block = (*this)(x, y);
+            block.transpose();
+        }
+    }
+
+    swap(blocksX_, blocksY_);
+    data_.swap(data);
+}
+
+
+void DxtImage::rotate(int quarter_turns)
+{
+    switch (quarter_turns & 3) {
+    case 1: transpose(); flip_x(); break;
+    case 2: flip_x(); flip_y(); break;
+    case 3: transpose(); flip_y(); break;
+    }
+}
+
+
+void DxtImage::crop(DxtImage const& source, int x, int y, int sizeX, int sizeY)
+{
+    if ((x | y | sizeX | sizeY) & 3) throw runtime_error("Crop rectangle must be aligned to 4 pixels.");
+    if (x < 0 || y < 0 || sizeX <= 0 || sizeY <= 0 || x + sizeX > source.sizeX() || y + sizeY > source.sizeY())
+        throw runtime_error("Crop rectangle must be inside the image.");
+
+    int x0 = x / DxtBlock::SIZE;
+    int y0 = y / DxtBlock::SIZE;
+
+    resize(sizeX / DxtBlock::SIZE, sizeY / DxtBlock::SIZE);
+
+    for (int by = 0; by < blocksY_; ++by) {
+        for (int bx = 0; bx < blocksX_; ++bx) {
+            (*this)(bx, by) = source(x0 + bx, y0 + by);
+        }
+    }
+}
@@ -0,0 +1,80 @@
+// DxtImage.h
+// DXT1 compressed image with transforms that work directly on the blocks.
+
+#ifndef DXTIMAGE_H
+#define DXTIMAGE_H
+
+#include <vector>
+#include <fstream>
+
+#include "DxtBlock.h"
+
+using namespace std;
+
+
+// DXT1 compressed image stored as blocks in DDS file order, that is, block rows
+// from top to bottom. Transforms permute blocks and remap block bitmaps without
+// re-encoding, so they are lossless.
+class DxtImage {
+
+  private:
+
+    int blocksX_;
+    int blocksY_;
+    vector<DxtBlock> data_;
+
+    size_t offset(int x, int y) const { return (size_t)y * blocksX_ + x; }
+
+  public:
+
+    DxtImage() : blocksX_(0), blocksY_(0) { }
+
+    int blocksX() const { return blocksX_; }
+    int blocksY() const { return blocksY_; }
+    int sizeX() const { return blocksX_ * DxtBlock::SIZE; }
+    int sizeY() const { return blocksY_ * DxtBlock::SIZE; }
+
+    // Block accessor. Block (0, 0) is at the top left corner of the image.
+    DxtBlock& operator() (int x, int y) { return data_[offset(x, y)]; }
+
+    // Block accessor. Block (0, 0) is at the top left corner of the image.
+    DxtBlock const& operator() (int x, int y) const { return data_[offset(x, y)]; }
+
+    // Resizes the image to the given number of blocks. Contents are undefined.
+    void resize(int blocksX, int blocksY);
+
+    // Reads a DXT1 DDS stream with one surface and no mipmaps. Throws runtime_error
+    // if something goes wrong.
+    void read_dds(istream&, bool verbose);
+
+    // Writes a DXT1 DDS stream.
+    void export_dds(ostream&, bool verbose);
+
+    // Reads the blocks from a stream that is positioned after the DDS header.
+    void read(istream&);
+
+    // Writes the blocks without a DDS header.
+    void write(ostream&) const;
+
+    // Mirrors the image horizontally.
+    void flip_x();
+
+    // Mirrors the image vertically.
+    void flip_y();
+
+    // Swaps the X and Y axes of the image.
+    void transpose();
+
+    // Rotates the image clockwise by the given number of quarter turns.
+    void rotate(int quarter_turns);
+
+    // Sets this image to the rectangle of the source image with the upper left corner
+    // at (x, y). All values are in pixels and must be divisible by 4. The source must
+    // be a different image. Throws runtime_error if the rectangle is not block aligned
+    // or not inside the source image.
+    void crop(DxtImage const& source, int x, int y, int sizeX, int sizeY);
+
+}; // class DxtImage
+
+
+#endif // DXTIMAGE_H
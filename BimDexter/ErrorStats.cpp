@@ -0,0 +1,57 @@
+// ErrorStats.cpp
+
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#include "ErrorStats.h"
+
+using namespace std;
+
+
+void ErrorStats::add(Pixel const& original, Pixel const& decoded)
+{
+    int e[3] = { original.r - decoded.r, original.g - decoded.g, original.b - decoded.b };
+
+    for (int i = 0; i < 3; ++i) {
+        squared += e[i] * e[i];
+        maximum = max(maximum, abs(e[i]));
+    }
+    count += 3;
+}
+
+
+void ErrorStats::add(Pixmap const& pixmap, int x, int y, DxtBlock const& block)
+{
+    Pixel pixels[DxtBlock::SIZE * DxtBlock::SIZE];
+    block.decode(pixels);
+
+    // Blocks are encoded upside down.
+    for (int dy = DxtBlock::SIZE - 1, i = 0; dy >= 0; --dy) {
+        for (int dx = 0; dx < DxtBlock::SIZE; ++dx) {
+            add(pixmap(x + dx, y + dy), pixels[i++]);
+        }
+    }
+}
+
+
+void ErrorStats::add(ErrorStats const& stats)
+{
+    squared += stats.squared;
+    count += stats.count;
+    maximum = max(maximum, stats.maximum);
+}
+
+
+double ErrorStats::rms() const
+{
+    return count > 0 ? sqrt(squared / (double)count) : 0.0;
+}
+
+
+double ErrorStats::psnr() const
+{
+    // Identical images have infinite PSNR; we cap it at 99 dB.
+    if (squared <= 0.0) return 99.0;
+    return min(99.0, 10.0 * log10(255.0 * 255.0 / (squared / (double)count)));
+}
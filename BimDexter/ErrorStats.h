@@ -0,0 +1,45 @@
+// ErrorStats.h
+// Pixel error statistics between original and compressed images.
+
+#ifndef ERRORSTATS_H
+#define ERRORSTATS_H
+
+#include <cstdint>
+
+#include "Pixmap.h"
+#include "DxtBlock.h"
+
+using namespace std;
+
+
+// Accumulates unweighted errors of 8-bit color components.
+struct ErrorStats {
+
+    // Sum of squared component errors.
+    double squared;
+    // Number of components compared.
+    int64_t count;
+    // Maximum absolute component error.
+    int maximum;
+
+    ErrorStats() : squared(0.0), count(0), maximum(0) {}
+
+    // Adds the errors of a decoded pixel.
+    void add(Pixel const& original, Pixel const& decoded);
+
+    // Adds the errors of the block encoded from the pixmap with the upper left corner at (x, y).
+    void add(Pixmap const& pixmap, int x, int y, DxtBlock const& block);
+
+    // Adds the statistics of another set of errors.
+    void add(ErrorStats const& stats);
+
+    // Root mean square component error.
+    double rms() const;
+
+    // Peak signal to noise ratio in decibels.
+    double psnr() const;
+
+}; // struct ErrorStats
+
+
+#endif // ERRORSTATS_H
@@ -0,0 +1,217 @@
+// Estimate.cpp
+
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+
+#include "Estimate.h"
+#include "PixelBlock.h"
+#include "FixedBlock.h"
+#include "ErrorStats.h"
+#include "JobQueue.h"
+
+using namespace std;
+using namespace std::chrono;
+
+
+// Number of strata. Blocks are classified by the binary logarithm of the trace
+// of their color covariance matrix, which is the total variance of the block.
+const int STRATA = 16;
+
+
+// Returns the stratum of the block with the upper left corner at (x, y).
+int stratum(Pixmap const& pixmap, int x, int y)
+{
+    auto sum = Vec3(0.0f);
+    auto sum2 = Vec3(0.0f);
+
+    for (int dy = 0; dy < 4; ++dy) {
+        for (int dx = 0; dx < 4; ++dx) {
+            auto pixel = pixmap(x + dx, y + dy);
+            auto c = Vec3(pixel.r, pixel.g, pixel.b);
+            sum += c;
+            sum2 += c * c;
+        }
+    }
+
+    auto trace = (sum2 - sum * sum / 16.0f).sum() / 16.0f;
+    if (trace < 1.0f) return 0;
+    return min(STRATA - 1, 1 + (int)log2(trace));
+}
+
+
+// Stratified estimate of a population total from per-block samples.
+struct StratifiedTotal {
+
+    double total;
+    double variance;
+
+    StratifiedTotal() : total(0.0), variance(0.0) {}
+
+    // Adds the sample of a stratum with the given number of blocks.
+    void add(vector<double> const& sample, int blocks)
+    {
+        int n = (int)sample.size();
+        if (n == 0) return;
+        double mean = 0.0;
+        for (auto x : sample) mean += x;
+        mean /= n;
+        total += blocks * mean;
+        if (n < 2) return;
+        double s2 = 0.0;
+        for (auto x : sample) s2 += (x - mean) * (x - mean);
+        s2 /= n - 1;
+        // Include the finite population correction.
+        variance += (double)blocks * blocks * (1.0 - (double)n / blocks) * s2 / n;
+    }
+
+    // Lower end of the 95% confidence interval.
+    double lower() const { return max(0.0, total - 1.96 * sqrt(variance)); }
+
+    // Upper end of the 95% confidence interval.
+    double upper() const { return total + 1.96 * sqrt(variance); }
+
+}; // struct StratifiedTotal
+
+
+// Compresses the block of the pixmap at (x, y) with the block type (PixelBlock or FixedBlock).
+// With warm starting, the left and upper neighbors within the band are compressed first
+// and their palettes are passed on, as in Pixmap::compress_dxt1. The neighbors themselves
+// are compressed without warm starts. Stores the time taken by the block itself in seconds.
+template <class Block> DxtBlock compress_sample(Pixmap const& pixmap, int x, int y, double& seconds)
+{
+    Block block;
+    typename Block::Palette left;
+    typename Block::Palette up;
+    bool has_left = false;
+    bool has_up = false;
+
+    if (PixelBlock::warmStart) {
+        if (x > 0) {
+            block.read(pixmap, x - 4, y);
+            block.compress_dxt1();
+            left = block.palette();
+            has_left = true;
+        }
+        // Blocks are compressed upside down, so the upper neighbor is at y + 4.
+        if ((pixmap.sizeY() - 4 - y) / 4 % Pixmap::WARM_START_ROWS != 0) {
+            block.read(pixmap, x, y + 4);
+            block.compress_dxt1();
+            up = block.palette();
+            has_up = true;
+        }
+    }
+
+    block.read(pixmap, x, y);
+    auto t0 = steady_clock::now();
+    auto dxt = block.compress_dxt1(has_left ? &left : nullptr, has_up ? &up : nullptr);
+    seconds = duration<double>(steady_clock::now() - t0).count();
+    return dxt;
+}
+
+
+void estimate_dxt1(Pixmap const& pixmap, double read_seconds, double fraction, ostream& report, bool verbose)
+{
+    auto time0 = steady_clock::now();
+
+    // Bands of block rows are compressed in parallel, so the compression time is divided
+    // between the threads, but there can be no more of them busy than there are bands.
+    int threads = JobQueue::threads > 0 ? JobQueue::threads : max(1, (int)thread::hardware_concurrency());
+    int bands = ((pixmap.sizeY() + 3) / 4 + Pixmap::WARM_START_ROWS - 1) / Pixmap::WARM_START_ROWS;
+    int workers = max(1, min(threads, bands));
+
+    // The time of the whole image also includes reading the BMP, measured by the caller,
+    // and storing the blocks in an output of the DDS file size, measured here.
+    {
+        vector<uint8_t> output(Pixmap::dds_size({ &pixmap }, false, false));
+        DxtBlock block = { 0, 0, 0 };
+        for (size_t i = 0; i + 8 <= output.size(); i += 8) block.store(&output[i]);
+    }
+    double overhead = read_seconds + duration<double>(steady_clock::now() - time0).count();
+
+    // Classify all blocks.
+    vector<pair<int, int>> stratumBlocks[STRATA];
+
+    for (int y = 0; y < pixmap.sizeY(); y += 4) {
+        for (int x = 0; x < pixmap.sizeX(); x += 4) {
+            stratumBlocks[stratum(pixmap, x, y)].push_back(make_pair(x, y));
+        }
+    }
+
+    // Draw the sample. Each nonempty stratum gets at least 2 blocks so that its
+    // variance can be estimated. The generator is seeded with a constant so that
+    // estimates are reproducible.
+    mt19937 random(1);
+    vector<pair<int, int>> sample[STRATA];
+    int sampled = 0;
+
+    for (int h = 0; h < STRATA; ++h) {
+        auto& blocks = stratumBlocks[h];
+        int n = min((int)blocks.size(), max(2, (int)ceil(fraction * blocks.size())));
+        for (int i = 0; i < n; ++i) {
+            swap(blocks[i], blocks[i + random() % (blocks.size() - i)]);
+            sample[h].push_back(blocks[i]);
+        }
+        sampled += n;
+    }
+
+    int totalBlocks = pixmap.sizeX() / 4 * pixmap.sizeY() / 4;
+    double components = 3.0 * pixmap.sizeX() * pixmap.sizeY();
+    int effort = PixelBlock::effort;
+
+    report << fixed;
+    report << "effort  RMS error  (95% interval)    max error  seconds  (95% interval)\n";
+    auto wall = [&](double seconds) { return seconds / workers + overhead; };
+
+    for (int e = 0; e < PixelBlock::EFFORTS; ++e) {
+        PixelBlock::setEffort(e);
+
+        StratifiedTotal squared;
+        StratifiedTotal seconds;
+        int maximum = 0;
+
+        for (int h = 0; h < STRATA; ++h) {
+            vector<double> squared_h;
+            vector<double> seconds_h;
+            for (auto& position : sample[h]) {
+                double block_seconds;
+                auto dxt = PixelBlock::fixedPoint
+                    ? compress_sample<FixedBlock>(pixmap, position.first, position.second, block_seconds)
+                    : compress_sample<PixelBlock>(pixmap, position.first, position.second, block_seconds);
+                ErrorStats stats;
+                stats.add(pixmap, position.first, position.second, dxt);
+                squared_h.push_back(stats.squared);
+                seconds_h.push_back(block_seconds);
+                maximum = max(maximum, stats.maximum);
+            }
+            squared.add(squared_h, (int)stratumBlocks[h].size());
+            seconds.add(seconds_h, (int)stratumBlocks[h].size());
+        }
+
+        report << setw(6) << e
+               << setprecision(2)
+               << setw(11) << sqrt(squared.total / components)
+               << "  [" << setw(6) << sqrt(squared.lower() / components)
+               << ", " << setw(6) << sqrt(squared.upper() / components) << "]"
+               << setw(8) << ">= " << setw(3) << maximum
+               << setprecision(3)
+               << setw(9) << wall(seconds.total)
+               << "  [" << setw(6) << wall(seconds.lower())
+               << ", " << setw(6) << wall(seconds.upper()) << "]\n";
+    }
+
+    PixelBlock::setEffort(effort);
+
+    if (verbose) {
+        cerr << "Estimated from " << sampled << " of " << totalBlocks << " blocks in "
+             << duration<double>(steady_clock::now() - time0).count() << " seconds.\n";
+        cerr << "Times are for " << workers << (workers > 1 ? " threads" : " thread") << " and include "
+             << overhead << " seconds of reading and writing.\n";
+        cerr << "Maximum errors are sample maxima, so the true maxima are at least as large.\n";
+    }
+}
@@ -0,0 +1,24 @@
+// Estimate.h
+// Sampling based estimation of compression quality and time.
+
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+#include <fstream>
+
+#include "Pixmap.h"
+
+using namespace std;
+
+
+// Estimates the RMS error and compression time of the pixmap at each effort level by
+// compressing a random sample of blocks stratified by the trace of their color covariance.
+// The fraction is the share of blocks sampled. Estimates with 95% confidence intervals are
+// written to the report stream, with the sample maximum error as a lower bound of the
+// maximum error. Blocks are compressed with the current engine, refinement and warm start
+// settings. The time is the wall clock time of a run with the current number of threads,
+// including read_seconds for reading the image and the time of writing the output.
+void estimate_dxt1(Pixmap const& pixmap, double read_seconds, double fraction, ostream& report, bool verbose);
+
+
+#endif // ESTIMATE_H
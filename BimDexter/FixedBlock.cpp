@@ -0,0 +1,419 @@
+// FixedBlock.cpp
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FIXEDBLOCK_SSE2
+#endif
+
+#include "FixedBlock.h"
+#include "PixelBlock.h"
+#include "Pixmap.h"
+#include "Common.h"
+
+using namespace std;
+
+
+// Palette color for each of the 4 levels along the axis from color 0 to color 1.
+extern int levelColor[4];
+
+
+// Divides a by b > 0, rounding to nearest. Ties are rounded away from zero.
+inline int64_t divide_round(int64_t a, int64_t b)
+{
+    return a >= 0 ? (a + b / 2) / b : -((b / 2 - a) / b);
+}
+
+
+// Integer square root, rounded down.
+uint64_t isqrt(uint64_t x)
+{
+    uint64_t root = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+    while (bit > x) bit >>= 2;
+    while (bit) {
+        if (x >= root + bit) {
+            x -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+
+const int FixedPalette::MAXIMUM;
+
+
+void FixedPalette::complete()
+{
+    for (int c = 0; c < 3; ++c) {
+        color[0][c] = ::clamp(0, MAXIMUM, color[0][c]);
+        color[1][c] = ::clamp(0, MAXIMUM, color[1][c]);
+        color[2][c] = (2 * color[0][c] + color[1][c] + 1) / 3;
+        color[3][c] = (color[0][c] + 2 * color[1][c] + 1) / 3;
+    }
+}
+
+
+FixedBlock::FixedBlock() : error_(0)
+{
+}
+
+
+void FixedBlock::read(Pixmap const& pixmap, int x, int y)
+{
+    int i = 0;
+
+    // DXT1 files are encoded upside down so we reverse the Y axis of the block here.
+    for (int dy = 3; dy >= 0; --dy) {
+        for (int dx = 0; dx < 4; ++dx) {
+            auto pixel = pixmap(min(x + dx, pixmap.sizeX() - 1), max(y + dy, 0));
+            data_[0][i] = (int16_t)(pixel.r << FixedPalette::FRACTION_BITS);
+            data_[1][i] = (int16_t)(pixel.g << FixedPalette::FRACTION_BITS);
+            data_[2][i] = (int16_t)(pixel.b << FixedPalette::FRACTION_BITS);
+            ++i;
+        }
+    }
+
+    DxtPalette::integerImportance(weight_);
+}
+
+
+int64_t FixedBlock::encode(FixedPalette const& palette, int gradient0[3], int gradient1[3], uint32_t* bitmap) const
+{
+    // The nearest level is found by projecting the pixel onto the palette axis
+    // as in CodedPixel::project. With d = color1 - color0, the projection parameter
+    // is t = 3 (p - color0) . W d / (d . W d), and comparing t against the thresholds
+    // 0.5, 1.5 and 2.5 is done without division as 6 numerator > (1, 3, 5) denominator.
+    // Coincident colors give a zero denominator and numerator, and every pixel
+    // projects to level 0.
+    int weighted_axis[3];
+    int denominator = 0;
+    for (int c = 0; c < 3; ++c) {
+        auto d = palette.color[1][c] - palette.color[0][c];
+        weighted_axis[c] = weight_[c] * d;
+        denominator += weighted_axis[c] * d;
+    }
+
+    int levels[N];
+    int64_t error = 0;
+
+#ifdef FIXEDBLOCK_SSE2
+
+    // Eight pixels are processed at a time in 16-bit lanes. Weighted axis components,
+    // pixel differences and weighted color errors all fit in 16 bits, and their
+    // products are summed in 32 bits with multiply-add.
+    auto zero = _mm_setzero_si128();
+    auto three = _mm_set1_epi16(3);
+    auto axisRG = _mm_set1_epi32((weighted_axis[1] << 16) | (weighted_axis[0] & 0xffff));
+    auto axisB = _mm_set1_epi32(weighted_axis[2] & 0xffff);
+    auto threshold1 = _mm_set1_epi32(denominator);
+    auto threshold2 = _mm_set1_epi32(3 * denominator);
+    auto threshold3 = _mm_set1_epi32(5 * denominator);
+
+    __m128i color0[3], step1[3], step2[3], step3[3], weight[3];
+    for (int c = 0; c < 3; ++c) {
+        color0[c] = _mm_set1_epi16((int16_t)palette.color[0][c]);
+        // Color differences between successive levels: color0, color2, color3, color1.
+        step1[c] = _mm_set1_epi16((int16_t)(palette.color[2][c] - palette.color[0][c]));
+        step2[c] = _mm_set1_epi16((int16_t)(palette.color[3][c] - palette.color[2][c]));
+        step3[c] = _mm_set1_epi16((int16_t)(palette.color[1][c] - palette.color[3][c]));
+        weight[c] = _mm_set1_epi16((int16_t)weight_[c]);
+    }
+
+    auto errorSum = zero;
+    __m128i gradient0Sum[3] = { zero, zero, zero };
+    __m128i gradient1Sum[3] = { zero, zero, zero };
+
+    for (int i = 0; i < N; i += 8) {
+        __m128i pixel[3], difference[3];
+        for (int c = 0; c < 3; ++c) {
+            pixel[c] = _mm_load_si128((__m128i const*)&data_[c][i]);
+            difference[c] = _mm_sub_epi16(pixel[c], color0[c]);
+        }
+
+        // Projection numerators of pixels i..i+3 and i+4..i+7.
+        auto numeratorLo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(difference[0], difference[1]), axisRG),
+                                         _mm_madd_epi16(_mm_unpacklo_epi16(difference[2], zero), axisB));
+        auto numeratorHi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(difference[0], difference[1]), axisRG),
+                                         _mm_madd_epi16(_mm_unpackhi_epi16(difference[2], zero), axisB));
+        numeratorLo = _mm_add_epi32(_mm_slli_epi32(numeratorLo, 2), _mm_slli_epi32(numeratorLo, 1));
+        numeratorHi = _mm_add_epi32(_mm_slli_epi32(numeratorHi, 2), _mm_slli_epi32(numeratorHi, 1));
+
+        // Threshold masks are -1 where passed. Levels are ordered along the axis,
+        // so each passed threshold adds one level step.
+        auto passed1 = _mm_packs_epi32(_mm_cmpgt_epi32(numeratorLo, threshold1), _mm_cmpgt_epi32(numeratorHi, threshold1));
+        auto passed2 = _mm_packs_epi32(_mm_cmpgt_epi32(numeratorLo, threshold2), _mm_cmpgt_epi32(numeratorHi, threshold2));
+        auto passed3 = _mm_packs_epi32(_mm_cmpgt_epi32(numeratorLo, threshold3), _mm_cmpgt_epi32(numeratorHi, threshold3));
+        auto level = _mm_sub_epi16(zero, _mm_add_epi16(_mm_add_epi16(passed1, passed2), passed3));
+        auto inverse_level = _mm_sub_epi16(three, level);
+        _mm_storeu_si128((__m128i*)&levels[i], _mm_unpacklo_epi16(level, zero));
+        _mm_storeu_si128((__m128i*)&levels[i + 4], _mm_unpackhi_epi16(level, zero));
+
+        for (int c = 0; c < 3; ++c) {
+            auto color = _mm_add_epi16(color0[c], _mm_and_si128(passed1, step1[c]));
+            color = _mm_add_epi16(color, _mm_and_si128(passed2, step2[c]));
+            color = _mm_add_epi16(color, _mm_and_si128(passed3, step3[c]));
+            auto g = _mm_sub_epi16(color, pixel[c]);
+            errorSum = _mm_add_epi32(errorSum, _mm_madd_epi16(g, _mm_mullo_epi16(g, weight[c])));
+            gradient0Sum[c] = _mm_add_epi32(gradient0Sum[c], _mm_madd_epi16(g, inverse_level));
+            gradient1Sum[c] = _mm_add_epi32(gradient1Sum[c], _mm_madd_epi16(g, level));
+        }
+    }
+
+    alignas(16) int32_t lanes[4];
+    _mm_store_si128((__m128i*)lanes, errorSum);
+    // Each lane is below 2^31 but their total may not be.
+    for (int j = 0; j < 4; ++j) error += lanes[j];
+    for (int c = 0; c < 3; ++c) {
+        _mm_store_si128((__m128i*)lanes, gradient0Sum[c]);
+        gradient0[c] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        _mm_store_si128((__m128i*)lanes, gradient1Sum[c]);
+        gradient1[c] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+
+#else
+
+    for (int i = 0; i < N; ++i) {
+        int numerator = 0;
+        for (int c = 0; c < 3; ++c) numerator += (data_[c][i] - palette.color[0][c]) * weighted_axis[c];
+        numerator *= 6;
+        int level = (int)(numerator > denominator) + (int)(numerator > 3 * denominator) + (int)(numerator > 5 * denominator);
+        levels[i] = level;
+        int pixel_error = 0;
+        for (int c = 0; c < 3; ++c) {
+            int g = palette.color[levelColor[level]][c] - data_[c][i];
+            pixel_error += g * g * weight_[c];
+            gradient0[c] += g * (3 - level);
+            gradient1[c] += g * level;
+        }
+        error += pixel_error;
+    }
+
+#endif
+
+    if (bitmap) {
+        for (int i = 0; i < N; ++i) *bitmap |= levelColor[levels[i]] << (i * 2);
+    }
+
+    return error;
+}
+
+
+DxtBlock FixedBlock::compress_dxt1(FixedPalette const* left, FixedPalette const* up)
+{
+    // This mirrors PixelBlock::compress_dxt1; see the comments there.
+    const int SHIFT = FixedPalette::FRACTION_BITS;
+    error_ = 0;
+
+    DxtBlock block;
+
+    // If the pixels are already DXT1 decoded, the block is encoded exactly as is.
+    Pixel pixels[N];
+    for (int i = 0; i < N; ++i) pixels[i] = Pixel(data_[0][i] >> SHIFT, data_[1][i] >> SHIFT, data_[2][i] >> SHIFT);
+    if (block.recover(pixels)) {
+        Pixel colors[FixedPalette::SIZE];
+        block.decode_palette(colors);
+        for (int i = 0; i < 2; ++i) {
+            palette_.color[i][0] = colors[i].r << SHIFT;
+            palette_.color[i][1] = colors[i].g << SHIFT;
+            palette_.color[i][2] = colors[i].b << SHIFT;
+        }
+        palette_.complete();
+        return block;
+    }
+
+    // Covariance of 8-bit components times N^2, computed exactly.
+    int sum[3] = { 0, 0, 0 };
+    int product[3][3] = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
+    int mini[3] = { 255, 255, 255 };
+    int maxi[3] = { 0, 0, 0 };
+
+    for (int i = 0; i < N; ++i) {
+        int p[3];
+        for (int c = 0; c < 3; ++c) {
+            p[c] = data_[c][i] >> SHIFT;
+            sum[c] += p[c];
+            mini[c] = min(mini[c], p[c]);
+            maxi[c] = max(maxi[c], p[c]);
+        }
+        for (int c = 0; c < 3; ++c)
+            for (int k = 0; k < 3; ++k) product[c][k] += p[c] * p[k];
+    }
+
+    int64_t cov[3][3];
+    for (int c = 0; c < 3; ++c)
+        for (int k = 0; k < 3; ++k) cov[c][k] = (int64_t)N * product[c][k] - (int64_t)sum[c] * sum[k];
+
+    // Constant color block.
+    if (cov[0][0] + cov[1][1] + cov[2][2] == 0) {
+        block.color0 = encode_565(sum[0] / N, sum[1] / N, sum[2] / N);
+        block.color1 = 0;
+        block.bitmap = 0;
+        for (int i = 0; i < FixedPalette::SIZE; ++i)
+            for (int c = 0; c < 3; ++c) palette_.color[i][c] = data_[c][0];
+        error_ = (float)block.error(pixels, weight_) / (float)(weight_[0] + weight_[1] + weight_[2]);
+        return block;
+    }
+
+    // Power iteration in unweighted coordinates. With W the diagonal weight matrix,
+    // the weighted covariance is sqrt(W) C sqrt(W), and its eigenvectors are sqrt(W) b
+    // where b are the eigenvectors of C W. The estimate is scaled to a maximum
+    // absolute component of 2^10 after each iteration.
+    int64_t b[3];
+    for (int c = 0; c < 3; ++c) b[c] = maxi[c] - mini[c];
+
+    for (int iteration = 0; iteration < 12; ++iteration) {
+        int64_t next[3];
+        int64_t largest = 0;
+        for (int c = 0; c < 3; ++c) {
+            next[c] = 0;
+            for (int k = 0; k < 3; ++k) next[c] += cov[c][k] * (weight_[k] * b[k]);
+            largest = max(largest, (int64_t)llabs(next[c]));
+        }
+        if (largest == 0) break;
+        for (int c = 0; c < 3; ++c) b[c] = next[c] * 1024 / largest;
+    }
+
+    // The variance along the weighted axis is Q / (N^2 B) with Q = (W b) . C (W b) and
+    // B = b . W b, and a unit step along the weighted axis is b / sqrt(B) in unweighted
+    // coordinates. The offset of a starting color from the mean for variance spread f
+    // is then b sqrt(f Q) / (N B).
+    int64_t Q = 0;
+    int64_t B = 0;
+    for (int c = 0; c < 3; ++c) {
+        B += weight_[c] * b[c] * b[c];
+        for (int k = 0; k < 3; ++k) Q += (weight_[c] * b[c]) * cov[c][k] * (weight_[k] * b[k]);
+    }
+
+    int mean[3];
+    for (int c = 0; c < 3; ++c) mean[c] = ((sum[c] << SHIFT) + N / 2) / N;
+
+    auto const& level = PixelBlock::effortLevel[PixelBlock::effort];
+    FixedPalette candidate_palette[PixelBlock::MAX_CANDIDATES];
+
+    for (int i = 0; i < level.candidates; ++i) {
+        // Spread f is 2^(i - (candidates - 1) / 2), which is at least 1/4. We take
+        // sqrt(4 f Q) and fold the factors 2^SHIFT / (2 N) into the divisor.
+        auto root = B > 0 && Q > 0 ? (int64_t)isqrt((uint64_t)Q << (i - (level.candidates - 1) / 2 + 2)) : 0;
+        for (int c = 0; c < 3; ++c) {
+            auto offset = B > 0 ? (int)divide_round(b[c] * root, B * 2 * N >> SHIFT) : 0;
+            candidate_palette[i].color[0][c] = mean[c] + offset;
+            candidate_palette[i].color[1][c] = mean[c] - offset;
+        }
+        candidate_palette[i].complete();
+    }
+
+    FixedPalette palette;
+    int64_t error = INT64_MAX;
+
+    bool warm = PixelBlock::warmStart && level.candidates > 1 && (left || up);
+    if (warm) {
+        int gradient0[3] = { 0, 0, 0 };
+        int gradient1[3] = { 0, 0, 0 };
+        for (auto neighbor : { left, up }) {
+            if (!neighbor) continue;
+            auto neighbor_error = encode(*neighbor, gradient0, gradient1);
+            if (neighbor_error < error) {
+                palette = *neighbor;
+                error = neighbor_error;
+            }
+        }
+        error = gradient_descent(level.short_iterations, palette);
+    }
+
+    int middle = (level.candidates - 1) / 2;
+    int reach = warm ? (level.candidates - 1) / 4 : level.candidates;
+
+    for (int i = 0; i < level.candidates; ++i) {
+        if (abs(i - middle) > reach) continue;
+        auto candidate_error = gradient_descent(level.short_iterations, candidate_palette[i]);
+        if (candidate_error < error) {
+            palette = candidate_palette[i];
+            error = candidate_error;
+        }
+    }
+
+    gradient_descent(PixelBlock::refinement ? level.refined_iterations : level.iterations, palette);
+
+    // Encode the block.
+
+    auto round8 = [&](int i, int c) { return (palette.color[i][c] + (1 << (SHIFT - 1))) >> SHIFT; };
+    block.color0 = encode_565(round8(0, 0), round8(0, 1), round8(0, 2));
+    block.color1 = encode_565(round8(1, 0), round8(1, 1), round8(1, 2));
+    block.bitmap = 0;
+
+    // DXT1 specifies that color0 > color1 for the block to be interpreted as
+    // a non-alpha encoding.
+    if (block.color0 < block.color1) {
+        swap(block.color0, block.color1);
+        swap(palette.color[0], palette.color[1]);
+        swap(palette.color[2], palette.color[3]);
+    }
+
+    int gradient0[3] = { 0, 0, 0 };
+    int gradient1[3] = { 0, 0, 0 };
+    encode(palette, gradient0, gradient1, &block.bitmap);
+
+    // If color0 = color1, the block is logically encoded with alpha but
+    // we use the first color only.
+    if (block.color0 == block.color1) block.bitmap = 0;
+
+    palette_ = palette;
+
+    int quantized_error = PixelBlock::refinement ? block.refine(pixels, weight_, level.sweeps) : block.error(pixels, weight_);
+    error_ = (float)quantized_error / (float)(weight_[0] + weight_[1] + weight_[2]);
+
+    return block;
+}
+
+
+int64_t FixedBlock::gradient_descent(int max_iterations, FixedPalette& palette) const
+{
+    // Step sizes are in units of 1/256 and follow PixelBlock::gradient_descent:
+    // start at 1/2, grow by 6/5 on success, halve on failure and stop at 1/32.
+    const int UNIT = 256;
+    int step_size = UNIT / 2;
+    int minimum_step_size = step_size >> 4;
+    // Bound the step size so that products stay in range.
+    const int MAXIMUM_STEP_SIZE = UNIT << 8;
+
+    int gradient0[3] = { 0, 0, 0 };
+    int gradient1[3] = { 0, 0, 0 };
+    auto error = encode(palette, gradient0, gradient1);
+
+    FixedPalette new_palette;
+
+    for (int iteration = 0; iteration < max_iterations && step_size > minimum_step_size; ++iteration) {
+
+        // Take a step in the gradient directions. Gradients are multiplied by 3.
+        for (int c = 0; c < 3; ++c) {
+            new_palette.color[0][c] = palette.color[0][c] - (int)divide_round((int64_t)gradient0[c] * step_size, 3 * UNIT);
+            new_palette.color[1][c] = palette.color[1][c] - (int)divide_round((int64_t)gradient1[c] * step_size, 3 * UNIT);
+        }
+        new_palette.complete();
+
+        int new_gradient0[3] = { 0, 0, 0 };
+        int new_gradient1[3] = { 0, 0, 0 };
+        auto new_error = encode(new_palette, new_gradient0, new_gradient1);
+
+        if (new_error < error) {
+            // Accept the step and increase step size.
+            palette = new_palette;
+            error   = new_error;
+            copy(new_gradient0, new_gradient0 + 3, gradient0);
+            copy(new_gradient1, new_gradient1 + 3, gradient1);
+            step_size = min(step_size * 6 / 5, MAXIMUM_STEP_SIZE);
+        } else {
+            // Error was not reduced. Try a smaller step size.
+            step_size >>= 1;
+        }
+    }
+
+    return error;
+}
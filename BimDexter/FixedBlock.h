@@ -0,0 +1,93 @@
+// FixedBlock.h
+// DXT1 block compression in fixed-point integer arithmetic.
+
+#ifndef FIXEDBLOCK_H
+#define FIXEDBLOCK_H
+
+#include <cstdint>
+
+#include "DxtBlock.h"
+
+using namespace std;
+
+
+// A DXT1 (non-alpha) block palette in fixed point. Components are 8-bit values
+// with FRACTION_BITS fractional bits and are not importance weighted.
+struct FixedPalette {
+
+    static const int SIZE = 4;
+
+    // Number of fractional bits in color components.
+    static const int FRACTION_BITS = 3;
+
+    // Largest component value.
+    static const int MAXIMUM = 255 << FRACTION_BITS;
+
+    // Colors 0 and 1 are encoded in the block. Colors 2 and 3 are interpolated from colors 0 and 1.
+    int color[SIZE][3];
+
+    // Clamps colors 0 and 1 and then interpolates colors 2 and 3 from colors 0 and 1.
+    void complete();
+
+}; // struct FixedPalette
+
+
+// 4x4 RGB pixel block compressed with the fixed-point engine. This follows the same
+// search as PixelBlock but uses integer arithmetic only, so the output is identical
+// on every platform, compiler and optimization setting. The search parameters
+// (effort level, warm starting) and color importances are taken from PixelBlock
+// and DxtPalette. Importances are rounded to integer weights in [0, 16], which
+// keeps every product in the pixel loop within 16 bits.
+class FixedBlock {
+
+  public:
+
+    // Number of pixels in the block.
+    static const int N = 16;
+
+    // Palette type used for warm starting.
+    typedef FixedPalette Palette;
+
+    FixedBlock();
+
+    // Reads this block from the pixmap at the specified position. Pixels outside
+    // the right and bottom (low Y) edges of the pixmap repeat the edge pixels.
+    void read(Pixmap const& pixmap, int x, int y);
+
+    // Total squared weighted compression error, scaled like PixelBlock::error().
+    float error() const { return error_; }
+
+    // Compresses the contents of this block. Returns the compressed block
+    // and sets the compression error and palette. If warm starting is enabled,
+    // the better final palette of the left and upper neighbors, if given, replaces
+    // the outer starting points at effort levels with several of them.
+    DxtBlock compress_dxt1(FixedPalette const* left = nullptr, FixedPalette const* up = nullptr);
+
+    // Palette found by the last compression.
+    FixedPalette const& palette() const { return palette_; }
+
+  private:
+
+    // Encodes all pixels using the palette. Returns total squared weighted error
+    // and accumulates error gradients, multiplied by 3. If bitmap is not null,
+    // pixel colors are stored there.
+    int64_t encode(FixedPalette const& palette, int gradient0[3], int gradient1[3], uint32_t* bitmap = nullptr) const;
+
+    // Runs gradient descent to fine-tune the palette.
+    int64_t gradient_descent(int max_iterations, FixedPalette& palette) const;
+
+    // Pixel components in planar order with FixedPalette::FRACTION_BITS fractional bits.
+    // Rows are stored top down as in PixelBlock.
+    alignas(16) int16_t data_[3][N];
+
+    // Integer color importance weights.
+    int weight_[3];
+
+    float error_;
+
+    FixedPalette palette_;
+
+}; // class FixedBlock
+
+
+#endif // FIXEDBLOCK_H
@@ -0,0 +1,39 @@
+// JobQueue.cpp
+
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "JobQueue.h"
+
+using namespace std;
+
+
+int JobQueue::threads = 0;
+
+
+void JobQueue::setThreads(int threads)
+{
+    JobQueue::threads = max(0, threads);
+}
+
+
+void JobQueue::run()
+{
+    int count = threads > 0 ? threads : (int)thread::hardware_concurrency();
+    count = max(1, min(count, (int)jobs_.size()));
+
+    // Each worker takes the next job in order until there are none left.
+    atomic<size_t> next(0);
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < jobs_.size(); i = next++) jobs_[i]();
+    };
+
+    vector<thread> pool;
+    for (int i = 1; i < count; ++i) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+
+    jobs_.clear();
+}
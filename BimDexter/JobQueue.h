@@ -0,0 +1,39 @@
+// JobQueue.h
+// Parallel execution of independent jobs.
+
+#ifndef JOBQUEUE_H
+#define JOBQUEUE_H
+
+#include <vector>
+#include <functional>
+
+using namespace std;
+
+
+// A queue of independent jobs that are run on a pool of threads.
+class JobQueue {
+
+  public:
+
+    // Adds a job to the queue.
+    void add(function<void ()> job) { jobs_.push_back(move(job)); }
+
+    // Runs all jobs in the queue and returns when they have finished.
+    // Jobs are started in the order they were added. Empties the queue.
+    void run();
+
+    // Sets the number of threads to use. Zero selects one thread per hardware thread,
+    // which is the default.
+    static void setThreads(int threads);
+
+    // Number of threads to use, or zero for one per hardware thread.
+    static int threads;
+
+  private:
+
+    vector<function<void ()>> jobs_;
+
+}; // class JobQueue
+
+
+#endif // JOBQUEUE_H
@@ -0,0 +1,149 @@
+// OutputFile.cpp
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#include "OutputFile.h"
+
+using namespace std;
+
+
+#ifdef _WIN32
+
+OutputFile::OutputFile(string const& filename, size_t size) : size_(size), data_(nullptr), mapped_(false), mapping_(nullptr)
+{
+    file_ = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) {
+        file_ = nullptr;
+        throw runtime_error("Cannot open output file.");
+    }
+
+    // Mapping a view larger than the file extends the file to the full size.
+    if (size > 0 && GetFileType(file_) == FILE_TYPE_DISK) {
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, nullptr);
+        if (mapping_) {
+            data_ = (uint8_t*)MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, size);
+            if (data_) {
+                mapped_ = true;
+            } else {
+                CloseHandle(mapping_);
+                mapping_ = nullptr;
+            }
+        }
+    }
+
+    if (!mapped_) {
+        buffer_.resize(size);
+        data_ = buffer_.data();
+    }
+}
+
+
+void OutputFile::close()
+{
+    if (!file_) return;
+
+    bool ok = true;
+    if (mapped_) {
+        ok = UnmapViewOfFile(data_) != 0;
+        CloseHandle(mapping_);
+    } else {
+        for (size_t written = 0; ok && written < size_; ) {
+            DWORD count = 0;
+            ok = WriteFile(file_, data_ + written, (DWORD)min(size_ - written, (size_t)1 << 30), &count, nullptr) && count > 0;
+            written += count;
+        }
+    }
+    ok = CloseHandle(file_) && ok;
+
+    file_ = nullptr;
+    mapping_ = nullptr;
+    data_ = nullptr;
+    mapped_ = false;
+    vector<uint8_t>().swap(buffer_);
+
+    if (!ok) throw runtime_error("Cannot write output file.");
+}
+
+#else
+
+OutputFile::OutputFile(string const& filename, size_t size) : size_(size), data_(nullptr), mapped_(false)
+{
+    file_ = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (file_ < 0) throw runtime_error("Cannot open output file.");
+
+    struct stat info;
+    if (size > 0 && fstat(file_, &info) == 0 && S_ISREG(info.st_mode) && ftruncate(file_, size) == 0) {
+#ifdef __linux__
+        // Reserve the disk space now, so that a full disk is not discovered as a fault
+        // while storing into the mapping. Not all file systems support this.
+        int result = posix_fallocate(file_, 0, size);
+        if (result != 0 && result != EOPNOTSUPP && result != EINVAL) {
+            // Leave an empty file rather than a sparse one that looks complete.
+            if (ftruncate(file_, 0) != 0) {}
+            ::close(file_);
+            file_ = -1;
+            throw runtime_error(result == ENOSPC ? "Not enough disk space for output file." : "Cannot allocate output file.");
+        }
+#endif
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file_, 0);
+        if (data != MAP_FAILED) {
+            data_ = (uint8_t*)data;
+            mapped_ = true;
+        }
+    }
+
+    if (!mapped_) {
+        buffer_.resize(size);
+        data_ = buffer_.data();
+    }
+}
+
+
+void OutputFile::close()
+{
+    if (file_ < 0) return;
+
+    bool ok = true;
+    if (mapped_) {
+        ok = munmap(data_, size_) == 0;
+    } else {
+        for (size_t written = 0; ok && written < size_; ) {
+            auto count = write(file_, data_ + written, size_ - written);
+            ok = count > 0;
+            if (ok) written += count;
+        }
+    }
+    ok = ::close(file_) == 0 && ok;
+
+    file_ = -1;
+    data_ = nullptr;
+    mapped_ = false;
+    vector<uint8_t>().swap(buffer_);
+
+    if (!ok) throw runtime_error("Cannot write output file.");
+}
+
+#endif
+
+
+OutputFile::~OutputFile()
+{
+    try {
+        close();
+    } catch(runtime_error e) {
+    }
+}
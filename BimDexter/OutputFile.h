@@ -0,0 +1,70 @@
+// OutputFile.h
+// Output file of known size written in place.
+
+#ifndef OUTPUTFILE_H
+#define OUTPUTFILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+// An output file that is created at its final size and mapped into memory, so that
+// any number of threads can store their results directly at computed offsets.
+// If the file cannot be mapped (for example, it is a pipe or a terminal), the contents
+// are kept in memory and written when the file is closed.
+class OutputFile {
+
+  public:
+
+    // Creates or truncates the file and preallocates the given number of bytes.
+    // Contents are undefined. Throws runtime_error if the file cannot be created or
+    // there is not enough disk space for it.
+    OutputFile(string const& filename, size_t size);
+
+    // Closes the file, ignoring errors.
+    ~OutputFile();
+
+    // Prohibit copy construction.
+    OutputFile(OutputFile const&) = delete;
+
+    // Prohibit assignment.
+    void operator= (OutputFile const&) = delete;
+
+    // Contents of the file. Valid until the file is closed.
+    uint8_t* data() { return data_; }
+
+    size_t size() const { return size_; }
+
+    // Unmaps or writes the contents and closes the file.
+    // Throws runtime_error if the contents cannot be written.
+    void close();
+
+  private:
+
+    size_t size_;
+
+    uint8_t* data_;
+
+    // Whether data_ is mapped to the file.
+    bool mapped_;
+
+    // Contents if the file could not be mapped.
+    vector<uint8_t> buffer_;
+
+#ifdef _WIN32
+    // File and mapping handles. The file handle is null if closed.
+    void* file_;
+    void* mapping_;
+#else
+    // File descriptor, or -1 if closed.
+    int file_;
+#endif
+
+}; // class OutputFile
+
+
+#endif // OUTPUTFILE_H
@@ -2,6 +2,8 @@
 
 #include <algorithm>
 #include <iostream>
+#include <cmath>
+#include <cstdlib>
 
 #include "PixelBlock.h"
 #include "Pixmap.h"
@@ -15,15 +17,38 @@ using namespace std;
 float colorWeight[4] { 0.0f, 1.0f, 1.0f/3.0f, 2.0f/3.0f };
 
 
+// Palette color for each of the 4 levels along the axis from color 0 to color 1.
+int levelColor[4] { 0, 2, 3, 1 };
+
+
 Vec3 DxtPalette::colorImportance = Vec3(sqrt(3.0f), sqrt(4.0f), sqrt(2.0f));
 
 
+bool DxtPalette::exactEncoding = false;
+
+
 void DxtPalette::setColorImportance(Vec3 importance)
 {
     colorImportance = Vec3(sqrt(importance.x), sqrt(importance.y), sqrt(importance.z));
 }
 
 
+void DxtPalette::setExactEncoding(bool exact)
+{
+    exactEncoding = exact;
+}
+
+
+void DxtPalette::integerImportance(int* weight)
+{
+    auto importance = colorImportance * colorImportance;
+    auto maximum = max(importance.x, max(importance.y, importance.z));
+    weight[0] = (int)(importance.x * 16.0f / maximum + 0.5f);
+    weight[1] = (int)(importance.y * 16.0f / maximum + 0.5f);
+    weight[2] = (int)(importance.z * 16.0f / maximum + 0.5f);
+}
+
+
 void DxtPalette::complete()
 {
     auto colorMaximum = colorImportance * 255.0f;
@@ -51,6 +76,180 @@ void CodedPixel::encode(Vec3 pixel, DxtPalette const& palette)
 }
 
 
+Vec3 CodedPixel::axis(DxtPalette const& palette)
+{
+    auto d = palette.color[1] - palette.color[0];
+    auto length2 = d.length2();
+    // With coincident colors every pixel projects to level 0.
+    return length2 > 0.0f ? d * (3.0f / length2) : Vec3(0.0f);
+}
+
+
+// This is the innermost loop of the compressor, so we make sure it gets inlined.
+inline void CodedPixel::project(Vec3 pixel, DxtPalette const& palette, Vec3 const& axis)
+{
+    // The palette colors are collinear and evenly spaced, so the nearest color
+    // is found by rounding the projection parameter to the nearest level.
+    // Importance weighting is already applied to the data, so this agrees with
+    // the exhaustive search except for ties and rounding.
+    auto t = Vec3::dot(pixel - palette.color[0], axis);
+    // Rounding to a level by counting thresholds passed compiles without branches.
+    auto level = (int)(t > 0.5f) + (int)(t > 1.5f) + (int)(t > 2.5f);
+    // This reproduces the interpolation weights in colorWeight exactly.
+    auto w = (float)level * (1.0f / 3.0f);
+    auto g = Vec3::lerp(palette.color[0], palette.color[1], w) - pixel;
+    error     = g.length2();
+    gradient0 = g * (1 - w);
+    gradient1 = g * w;
+    color     = levelColor[level];
+}
+
+
+// Evaluates palettes for gradient descent incrementally. Pixels are assigned to palette
+// levels by projection as in CodedPixel::project. The pixels of each level are summarized
+// by their count, mean and scatter, from which the error and gradients of any palette follow
+// in closed form. Late in a descent, steps are small and few pixels change level, so each
+// evaluation projects the pixels and accounts only for those that moved individually.
+class LevelEncoder {
+
+  public:
+
+    LevelEncoder(Vec3 const* data) : data_(data) {}
+
+    // Assigns every pixel with the palette and summarizes the levels. Returns total squared
+    // error and stores error gradients like PixelBlock::encode does.
+    float reset(DxtPalette const& palette, Vec3& gradient0, Vec3& gradient1);
+
+    // Returns total squared error of the palette and stores error gradients.
+    float evaluate(DxtPalette const& palette, Vec3& gradient0, Vec3& gradient1);
+
+    // Adopts the assignment of the last evaluation.
+    void accept();
+
+  private:
+
+    static const int N = PixelBlock::N;
+
+    // Level of a projection parameter.
+    static int level(float t) { return (int)(t > 0.5f) + (int)(t > 1.5f) + (int)(t > 2.5f); }
+
+    // Adds (sign = 1) or removes (sign = -1) a pixel to or from the summary of a level.
+    void update(int level, Vec3 const& pixel, float sign);
+
+    Vec3 const* data_;
+
+    // Level of each pixel.
+    int level_[N];
+
+    // Pixels that changed level in the last evaluation and their new levels.
+    int moved_[N];
+    int movedLevel_[N];
+    int moves_;
+
+    // Summaries of the levels.
+    float count_[DxtPalette::SIZE];
+    Vec3 mean_[DxtPalette::SIZE];
+    float scatter_[DxtPalette::SIZE];
+
+}; // class LevelEncoder
+
+
+void LevelEncoder::update(int level, Vec3 const& pixel, float sign)
+{
+    // Welford's update of the mean and the scatter.
+    auto count = count_[level] + sign;
+    if (count <= 0.0f) {
+        count_[level] = 0.0f;
+        mean_[level] = Vec3(0.0f);
+        scatter_[level] = 0.0f;
+        return;
+    }
+    auto mean = mean_[level] + (pixel - mean_[level]) * (sign / count);
+    scatter_[level] = max(0.0f, scatter_[level] + sign * Vec3::dot(pixel - mean_[level], pixel - mean));
+    mean_[level] = mean;
+    count_[level] = count;
+}
+
+
+float LevelEncoder::reset(DxtPalette const& palette, Vec3& gradient0, Vec3& gradient1)
+{
+    auto axis = CodedPixel::axis(palette);
+
+    for (int l = 0; l < DxtPalette::SIZE; ++l) {
+        count_[l] = 0.0f;
+        mean_[l] = Vec3(0.0f);
+        scatter_[l] = 0.0f;
+    }
+
+    for (int i = 0; i < N; ++i) {
+        level_[i] = level(Vec3::dot(data_[i] - palette.color[0], axis));
+        count_[level_[i]] += 1.0f;
+        mean_[level_[i]] += data_[i];
+    }
+
+    for (int l = 0; l < DxtPalette::SIZE; ++l)
+        if (count_[l] > 0.0f) mean_[l] /= count_[l];
+    for (int i = 0; i < N; ++i)
+        scatter_[level_[i]] += (data_[i] - mean_[level_[i]]).length2();
+
+    return evaluate(palette, gradient0, gradient1);
+}
+
+
+float LevelEncoder::evaluate(DxtPalette const& palette, Vec3& gradient0, Vec3& gradient1)
+{
+    // The squared error of a level is its scatter plus count times the squared distance
+    // from the level color to the mean, and the gradient is count times the difference.
+    Vec3 color[DxtPalette::SIZE];
+    auto error = 0.0f;
+
+    for (int l = 0; l < DxtPalette::SIZE; ++l) {
+        auto w = (float)l * (1.0f / 3.0f);
+        color[l] = Vec3::lerp(palette.color[0], palette.color[1], w);
+        if (count_[l] == 0.0f) continue;
+        auto g = color[l] - mean_[l];
+        error     += Vec3::dot(g, g) * count_[l] + scatter_[l];
+        gradient0 += g * (count_[l] * (1 - w));
+        gradient1 += g * (count_[l] * w);
+    }
+
+    // Move the contributions of the pixels that changed level.
+    auto axis = CodedPixel::axis(palette);
+    moves_ = 0;
+
+    for (int i = 0; i < N; ++i) {
+        auto to = level(Vec3::dot(data_[i] - palette.color[0], axis));
+        auto from = level_[i];
+        if (to == from) continue;
+
+        auto g_from = color[from] - data_[i];
+        auto g_to = color[to] - data_[i];
+        auto w_from = (float)from * (1.0f / 3.0f);
+        auto w_to = (float)to * (1.0f / 3.0f);
+        error     += g_to.length2() - g_from.length2();
+        gradient0 += g_to * (1 - w_to) - g_from * (1 - w_from);
+        gradient1 += g_to * w_to - g_from * w_from;
+
+        moved_[moves_] = i;
+        movedLevel_[moves_++] = to;
+    }
+
+    return error;
+}
+
+
+void LevelEncoder::accept()
+{
+    for (int j = 0; j < moves_; ++j) {
+        auto i = moved_[j];
+        update(level_[i], data_[i], -1.0f);
+        update(movedLevel_[j], data_[i], 1.0f);
+        level_[i] = movedLevel_[j];
+    }
+    moves_ = 0;
+}
+
+
 PixelBlock::PixelBlock() : data_(Vec3(0), N), error_(0)
 {
 }
@@ -63,18 +262,39 @@ void PixelBlock::read(Pixmap const& pixmap, int x, int y)
     // DXT1 files are encoded upside down so we reverse the Y axis of the block here.
     for (int dy = 3; dy >= 0; --dy) {
         for (int dx = 0; dx < 4; ++dx) {
-            auto pixel = pixmap(x + dx, y + dy);
+            auto pixel = pixmap(min(x + dx, pixmap.sizeX() - 1), max(y + dy, 0));
+            pixels_[i] = pixel;
             data_[i++] = Vec3(pixel.r, pixel.g, pixel.b) * DxtPalette::colorImportance;
         }
     }
 }
 
 
+float PixelBlock::encode(DxtPalette const& palette, Vec3& gradient0, Vec3& gradient1, uint32_t* bitmap) const
+{
+    CodedPixel coded;
+    auto error = 0.0f;
+    auto axis = CodedPixel::axis(palette);
+
+    for (int i = 0; i < N; ++i) {
+        if (DxtPalette::exactEncoding)
+            coded.encode(data_[i], palette);
+        else
+            coded.project(data_[i], palette, axis);
+        error += coded.error;
+        gradient0 += coded.gradient0;
+        gradient1 += coded.gradient1;
+        if (bitmap) *bitmap |= coded.color << (i * 2);
+    }
+
+    return error;
+}
+
+
 // Converts an 8-bit color value to a 5-bit color value. This inverts the 5-to-8 bit
 // conversion (x << 3) + (x << 2). The formula was discovered with genetic programming.
-int convert_8to5(float f)
+int convert_8to5(int x)
 {
-    int x = (int)roundf(f);
     int r5 = x - ((x - 124) >> 5);
     return r5 >> 3;
 }
@@ -82,23 +302,152 @@ int convert_8to5(float f)
 
 // Converts an 8-bit color value to a 6-bit color value. This inverts the 6-to-8 bit
 // conversion (x << 2) + (x >> 4). The formula was discovered with genetic programming.
-int convert_8to6(float f)
+int convert_8to6(int x)
 {
-    int x = (int)roundf(f) + 2;
+    x += 2;
     int r3 = x - (x >> 6);
     return r3 >> 2;
 }
 
 
+uint16_t encode_565(int r, int g, int b)
+{
+    return ((uint16_t)convert_8to5(b) << 11) + ((uint16_t)convert_8to6(g) << 5) + (uint16_t)convert_8to5(r);
+}
+
+
 // Encodes an importance weighted 24-bit RGB triple in the R5G6B5 16-bit format used by DXT1.
 uint16_t encode_565(Vec3 const& color)
 {
     auto color8 = color / DxtPalette::colorImportance;
-    return ((uint16_t)convert_8to5(color8.z) << 11) + ((uint16_t)convert_8to6(color8.y) << 5) + (uint16_t)convert_8to5(color8.x);
+    return encode_565((int)roundf(color8.x), (int)roundf(color8.y), (int)roundf(color8.z));
 }
 
 
-DxtBlock PixelBlock::compress_dxt1()
+// If the gap between the two largest eigenvalues of a block covariance matrix is below
+// this fraction of the largest, the principal axis is found by power iteration.
+const double DEGENERACY = 1.0e-3;
+
+
+// Finds the principal eigenpair of the symmetric 3x3 matrix with rows covX, covY and covZ.
+// The eigenvalues are the roots of the characteristic cubic, which are found in double
+// precision, and the eigenvector is the largest cross product of two rows of
+// the matrix minus the largest eigenvalue. If the two largest eigenvalues are nearly equal,
+// the eigenvector is ill conditioned; then power iteration is run from the start vector
+// until it converges. The axis is oriented to agree with the start vector.
+void principal_axis(Vec3 const& covX, Vec3 const& covY, Vec3 const& covZ, Vec3 const& start, Vec3& axis, float& value)
+{
+    double a = covX.x, b = covY.y, c = covZ.z;
+    double d = covX.y, e = covY.z, f = covX.z;
+
+    double q = (a + b + c) / 3.0;
+    double p2 = (a - q) * (a - q) + (b - q) * (b - q) + (c - q) * (c - q) + 2.0 * (d * d + e * e + f * f);
+    double p = sqrt(p2 / 6.0);
+
+    if (p > 0.0) {
+        // The eigenvalues of B = (A - qI) / p are the roots of x^3 - 3 x - det(B), all in [-2, 2].
+        // Newton's method from 2 converges monotonically and quadratically to the largest root,
+        // so after a step below 1e-4 the error is about 1e-8. The other two roots then solve
+        // a quadratic equation.
+        double inverse = 1.0 / p;
+        double ba = (a - q) * inverse, bb = (b - q) * inverse, bc = (c - q) * inverse;
+        double bd = d * inverse, be = e * inverse, bf = f * inverse;
+        double det = ba * (bb * bc - be * be) - bd * (bd * bc - be * bf) + bf * (bd * be - bb * bf);
+        double x = 2.0;
+        for (int iteration = 0; iteration < 16; ++iteration) {
+            double step = (x * x * x - 3.0 * x - det) / (3.0 * x * x - 3.0);
+            x -= step;
+            if (!(step > 1.0e-4)) break;
+        }
+        double largest = q + p * x;
+        double middle = q + p * 0.5 * (sqrt(max(0.0, 12.0 - 3.0 * x * x)) - x);
+
+        if (largest - middle > DEGENERACY * largest) {
+            // Rows of A - largest I span a plane orthogonal to the eigenvector.
+            double r[3][3] = { { a - largest, d, f }, { d, b - largest, e }, { f, e, c - largest } };
+            double best[3] = { 0.0, 0.0, 0.0 };
+            double best_length2 = 0.0;
+            for (int i = 0; i < 3; ++i) {
+                auto& u = r[i];
+                auto& v = r[(i + 1) % 3];
+                double w[3] = { u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0] };
+                double length2 = w[0] * w[0] + w[1] * w[1] + w[2] * w[2];
+                if (length2 > best_length2) {
+                    best_length2 = length2;
+                    copy(w, w + 3, best);
+                }
+            }
+            if (best_length2 > 0.0) {
+                double scale = 1.0 / sqrt(best_length2);
+                axis = Vec3((float)(best[0] * scale), (float)(best[1] * scale), (float)(best[2] * scale));
+                if (Vec3::dot(axis, start) < 0.0f) axis = axis * -1.0f;
+                value = (float)largest;
+                return;
+            }
+        }
+    }
+
+    // Power iteration converges slowly if there is more than one prominent eigenvalue of similar
+    // magnitude; the start vector at least provides good contrast then.
+    axis = start;
+    value = 0.0f;
+    for (int iteration = 0; iteration < 12; ++iteration) {
+        auto next = Vec3(Vec3::dot(axis, covX), Vec3::dot(axis, covY), Vec3::dot(axis, covZ));
+        value = next.length();
+        if (value <= 0.0f) break;
+        next /= value;
+        bool converged = (next - axis).length2() < 1.0e-8f;
+        axis = next;
+        if (converged) break;
+    }
+}
+
+
+bool PixelBlock::warmStart = false;
+
+
+int PixelBlock::effort = 1;
+
+
+bool PixelBlock::fixedPoint = false;
+
+
+bool PixelBlock::refinement = true;
+
+
+// Search parameters for each effort level.
+PixelBlock::Effort PixelBlock::effortLevel[EFFORTS] {
+    { 1,  0,  16,  8, 8 },
+    { 3,  8,  64,  8, 0 },
+    { 5, 16, 256, 16, 0 },
+};
+
+
+void PixelBlock::setEffort(int level)
+{
+    effort = ::clamp(0, EFFORTS - 1, level);
+}
+
+
+void PixelBlock::setWarmStart(bool warm)
+{
+    warmStart = warm;
+}
+
+
+void PixelBlock::setFixedPoint(bool fixed)
+{
+    fixedPoint = fixed;
+}
+
+
+void PixelBlock::setRefinement(bool refine)
+{
+    refinement = refine;
+}
+
+
+DxtBlock PixelBlock::compress_dxt1(DxtPalette const* left, DxtPalette const* up)
 {
     // Here we are explicitly attempting to minimize total squared error
     // with respect to importance weighted components. This makes the most sense
@@ -114,26 +463,55 @@ DxtBlock PixelBlock::compress_dxt1()
 
     DxtBlock block;
 
-    // Compute the covariance matrix for the color components. The matrix is symmetric
-    // so we can regard covX, covY and covZ as either rows or columns.
+    // If the pixels are already DXT1 decoded, the block is encoded exactly as is.
+    if (block.recover(pixels_)) {
+        Pixel colors[DxtPalette::SIZE];
+        block.decode_palette(colors);
+        for (int i = 0; i < 2; ++i) palette_.color[i] = Vec3(colors[i].r, colors[i].g, colors[i].b) * DxtPalette::colorImportance;
+        palette_.complete();
+        return block;
+    }
+
+    // Compute the mean, the covariance matrix for the color components and the bounding box
+    // of the colors in one pass. The matrix is symmetric so we can regard covX, covY and covZ
+    // as either rows or columns. Moments are taken relative to the first pixel, which is
+    // close to the others, so that there is little cancellation in the subtraction below.
 
-    auto mean = data_.sum() / (float)N;
+    auto origin = data_[0];
+    auto sum = Vec3(0.0f);
     auto covX = Vec3(0.0f);
     auto covY = Vec3(0.0f);
     auto covZ = Vec3(0.0f);
+    auto mini = origin;
+    auto maxi = origin;
 
     for(int i = 0; i < N; ++i) {
-        auto d = data_[i] - mean;
+        auto d = data_[i] - origin;
+        sum  += d;
         covX += d * d.x;
         covY += d * d.y;
         covZ += d * d.z;
+        mini = Vec3::minimize(mini, data_[i]);
+        maxi = Vec3::maximize(maxi, data_[i]);
     }
 
+    auto offset = sum / (float)N;
+    auto mean = origin + offset;
+    covX -= offset * sum.x;
+    covY -= offset * sum.y;
+    covZ -= offset * sum.z;
+
     // Check here if we have a constant color block. Include some numerical tolerance in the test.
     if (covX.x + covY.y + covZ.z < 0.1f) {
         block.color0 = encode_565(data_[0]);
         block.color1 = 0;
         block.bitmap = 0;
+        palette_.color[0] = data_[0];
+        palette_.color[1] = data_[0];
+        palette_.complete();
+        int weight[3];
+        DxtPalette::integerImportance(weight);
+        error_ = (float)block.error(pixels_, weight) / (float)(weight[0] + weight[1] + weight[2]);
         return block;
     }
 
@@ -143,62 +521,72 @@ DxtBlock PixelBlock::compress_dxt1()
     covY /= (float)N;
     covZ /= (float)N;
 
-    // Now we approximate the principal eigenpair using power iteration. The largest amount of
-    // variance is concentrated in the direction of the principal eigenvector, and that is what
-    // we want to account for with our color choices.
-    // As a starting point, we pick a diagonal of the bounding box of the colors in the block.
-    // Power iteration converges slowly if there is more than one prominent eigenvalue of similar
-    // magnitude; the initial guess at least provides good contrast then.
-    // We could also derive the eigenpairs from the solutions of a cubic equation but that
-    // is not likely to be significantly faster, and would require higher numerical precision.
-
-    auto mini = data_[0];
-    auto maxi = data_[0];
-
-    for(int i = 1; i < N; ++i) {
-        mini = Vec3::minimize(mini, data_[i]);
-        maxi = Vec3::maximize(maxi, data_[i]);
-    }
-
-    // The eigenvector estimate is stored here.
-    auto b = maxi - mini;
-
-    // The eigenvalue estimate is stored here.
-    auto v = 0.0f;
+    // Now we find the principal eigenpair. The largest amount of variance is concentrated
+    // in the direction of the principal eigenvector, and that is what we want to account for
+    // with our color choices. The diagonal of the bounding box of the colors in the block
+    // orients the eigenvector and is the starting point if power iteration is needed.
 
-    // Do a fixed number of iterations.
-    for(int iteration = 0; iteration < 12; ++iteration) {
-        b  = Vec3(Vec3::dot(b, covX), Vec3::dot(b, covY), Vec3::dot(b, covZ));
-        v  = b.length();
-        b /= v;
-    }
+    // The eigenvector is stored in b and the eigenvalue in v.
+    Vec3 b;
+    float v;
+    principal_axis(covX, covY, covZ, maxi - mini, b, v);
 
     // Now estimate the two colors from sample mean and the principal eigenpair.
     // (The sample mean is the single point that minimizes squared error.)
     // The other two colors are interpolated from them. We run gradient descent
-    // for a small amount of steps with three different starting points, keep
-    // the best result, and refine it some more.
+    // for a small amount of steps with different starting points, keep
+    // the best result, and refine it some more. The number of starting points
+    // and steps depends on the effort level. At the default level there are
+    // three starting points with spreads of 0.5, 1 and 2 times the variance.
+    // Finally, the quantized colors are refined on the 565 lattice.
+
+    auto const& level = effortLevel[effort];
+    DxtPalette candidate_palette[MAX_CANDIDATES];
+
+    for (int i = 0; i < level.candidates; ++i) {
+        auto stdev = sqrt(ldexp(1.0f, i - (level.candidates - 1) / 2) * v);
+        candidate_palette[i].color[0] = mean + stdev * b;
+        candidate_palette[i].color[1] = mean - stdev * b;
+        candidate_palette[i].complete();
+    }
 
     DxtPalette palette;
     auto error = 1.0e10f;
 
-    for (float factor = 0.5f; factor <= 2.0f; factor *= 2.0f) {
-        auto stdev = sqrt(factor * v);
-
-        DxtPalette candidate_palette;
-        candidate_palette.color[0] = mean + stdev * b;
-        candidate_palette.color[1] = mean - stdev * b;
-        candidate_palette.complete();
+    // With warm starting, the better final palette of the left and upper neighbors gets a
+    // short descent of its own and takes the place of the outer starting points, so that
+    // only the middle ones are descended: 1 of 3 at the default level and 3 of 5 at the
+    // high level. Neighboring blocks are usually alike, so this saves a quarter of the time
+    // at little loss. With a single starting point there is nothing to save.
+    bool warm = warmStart && level.candidates > 1 && (left || up);
+    if (warm) {
+        auto gradient0 = Vec3(0.0f);
+        auto gradient1 = Vec3(0.0f);
+        for (auto neighbor : { left, up }) {
+            if (!neighbor) continue;
+            auto neighbor_error = encode(*neighbor, gradient0, gradient1);
+            if (neighbor_error < error) {
+                palette = *neighbor;
+                error = neighbor_error;
+            }
+        }
+        error = gradient_descent(level.short_iterations, palette);
+    }
 
-        auto candidate_error = gradient_descent(8, candidate_palette);
+    // Starting points further than reach from the middle one are skipped.
+    int middle = (level.candidates - 1) / 2;
+    int reach = warm ? (level.candidates - 1) / 4 : level.candidates;
 
+    for (int i = 0; i < level.candidates; ++i) {
+        if (abs(i - middle) > reach) continue;
+        auto candidate_error = gradient_descent(level.short_iterations, candidate_palette[i]);
         if (candidate_error < error) {
-            palette = candidate_palette;
+            palette = candidate_palette[i];
             error = candidate_error;
         }
     }
 
-    error = gradient_descent(64, palette);
+    error = gradient_descent(refinement ? level.refined_iterations : level.iterations, palette);
 
     // Encode the block.
 
@@ -214,19 +602,23 @@ DxtBlock PixelBlock::compress_dxt1()
         swap(palette.color[2], palette.color[3]);
     }
 
-    CodedPixel coded;
-
-    for (int i = 0; i < N; ++i) {
-        coded.encode(data_[i], palette);
-        error_ += coded.error;
-        block.bitmap |= coded.color << (i * 2);
-    }
+    auto gradient0 = Vec3(0.0f);
+    auto gradient1 = Vec3(0.0f);
+    encode(palette, gradient0, gradient1, &block.bitmap);
 
     // If color0 = color1, the block is logically encoded with alpha but
     // we use the first color only.
     if (block.color0 == block.color1) block.bitmap = 0;
 
-    error_ /= DxtPalette::colorImportance.length2();
+    palette_ = palette;
+
+    // Search for the best quantized colors near the result. Gradient descent does not
+    // know about quantization, so this finds a better pair for many blocks. The error
+    // is that of the quantized block either way.
+    int weight[3];
+    DxtPalette::integerImportance(weight);
+    int quantized_error = refinement ? block.refine(pixels_, weight, level.sweeps) : block.error(pixels_, weight);
+    error_ = (float)quantized_error / (float)(weight[0] + weight[1] + weight[2]);
 
     return block;
 }
@@ -241,17 +633,13 @@ float PixelBlock::gradient_descent(int max_iterations, DxtPalette& palette)
     // The divisor (1 << N) translates to N rejected steps.
     float minimum_step_size = step_size / (1 << 4);
 
-    CodedPixel coded;
-    auto error = 0.0f;
+    // With projection, palettes are evaluated incrementally.
+    bool incremental = !DxtPalette::exactEncoding;
+    LevelEncoder levels(&data_[0]);
+
     auto gradient0 = Vec3(0.0f);
     auto gradient1 = Vec3(0.0f);
-
-    for (int i = 0; i < N; ++i) {
-        coded.encode(data_[i], palette);
-        error += coded.error;
-        gradient0 += coded.gradient0;
-        gradient1 += coded.gradient1;
-    }
+    auto error = incremental ? levels.reset(palette, gradient0, gradient1) : encode(palette, gradient0, gradient1);
 
     DxtPalette new_palette;
 
@@ -262,19 +650,13 @@ float PixelBlock::gradient_descent(int max_iterations, DxtPalette& palette)
             new_palette.color[i] = palette.color[i] - Vec3::lerp(gradient0, gradient1, colorWeight[i]) * step_size;
         new_palette.complete();
 
-        auto new_error = 0.0f;
         auto new_gradient0 = Vec3(0.0f);
         auto new_gradient1 = Vec3(0.0f);
-
-        for (int i = 0; i < N; ++i) {
-            coded.encode(data_[i], new_palette);
-            new_error += coded.error;
-            new_gradient0 += coded.gradient0;
-            new_gradient1 += coded.gradient1;
-        }
+        auto new_error = incremental ? levels.evaluate(new_palette, new_gradient0, new_gradient1) : encode(new_palette, new_gradient0, new_gradient1);
 
         if (new_error < error) {
             // Accept the step and increase step size.
+            if (incremental) levels.accept();
             palette   = new_palette;
             error     = new_error;
             gradient0 = new_gradient0;
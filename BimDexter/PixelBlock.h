@@ -30,9 +30,24 @@ struct DxtPalette {
     // (Square roots of) color importances are stored here.
     static Vec3 colorImportance;
 
+    // Selects exhaustive nearest color search for pixel encoding instead of
+    // projection onto the palette axis. This is off by default.
+    static void setExactEncoding(bool exact);
+
+    // Whether pixels are encoded with exhaustive search.
+    static bool exactEncoding;
+
+    // Returns color importances as integer weights in [0, 16] relative to the most important
+    // component, which gets weight 16.
+    static void integerImportance(int* weight);
+
 }; // struct DxtPalette
 
 
+// Encodes an 8-bit RGB triple in the R5G6B5 16-bit format used by DXT1.
+uint16_t encode_565(int r, int g, int b);
+
+
 // Result of encoding a single pixel.
 struct CodedPixel {
 
@@ -48,6 +63,14 @@ struct CodedPixel {
     // Encodes the pixel using the palette and stores the results here.
     void encode(Vec3 pixel, DxtPalette const& palette);
 
+    // Encodes the pixel by projecting it onto the palette axis. The axis is
+    // (color1 - color0) scaled by 3 / |color1 - color0|^2; see axis().
+    // Only usable from PixelBlock.cpp where it is defined inline.
+    void project(Vec3 pixel, DxtPalette const& palette, Vec3 const& axis);
+
+    // Returns the scaled palette axis for use with project().
+    static Vec3 axis(DxtPalette const& palette);
+
 }; // struct CodedPixel
 
 
@@ -59,33 +82,106 @@ class PixelBlock {
     // Number of pixels in the block.
     static const int N = 16;
 
+    // Palette type used for warm starting.
+    typedef DxtPalette Palette;
+
     PixelBlock();
 
-    // Reads this block from the pixmap at the specified position.
+    // Reads this block from the pixmap at the specified position. Pixels outside
+    // the right and bottom (low Y) edges of the pixmap repeat the edge pixels.
     void read(Pixmap const& pixmap, int x, int y);
 
-    // Total squared weighted compression error. Does not include quantization
-    // error from the block palette.
+    // Total squared weighted compression error of the encoded block, including
+    // quantization error from the 565 colors.
     float error() const { return error_; }
 
     // Compresses the contents of this block. Returns the compressed block
-    // and sets the compression error.
-    DxtBlock compress_dxt1();
+    // and sets the compression error and palette. If warm starting is enabled,
+    // the better final palette of the left and upper neighbors, if given, replaces
+    // the outer starting points at effort levels with several of them.
+    DxtBlock compress_dxt1(DxtPalette const* left = nullptr, DxtPalette const* up = nullptr);
+
+    // Unquantized palette found by the last compression.
+    DxtPalette const& palette() const { return palette_; }
+
+    // Selects whether neighboring blocks' palettes are used as starting points.
+    // This is off by default.
+    static void setWarmStart(bool warm);
+
+    // Whether neighboring blocks' palettes are used as starting points.
+    static bool warmStart;
+
+    // Number of effort levels.
+    static const int EFFORTS = 3;
+
+    // Sets the effort level in [0, EFFORTS - 1]. Higher levels are slower
+    // and more accurate. The default level is 1.
+    static void setEffort(int level);
+
+    // Current effort level.
+    static int effort;
+
+    // Selects the fixed-point engine (FixedBlock) for image compression.
+    // This is off by default.
+    static void setFixedPoint(bool fixed);
+
+    // Whether images are compressed with the fixed-point engine.
+    static bool fixedPoint;
+
+    // Selects whether the quantized colors are refined on the 565 lattice after
+    // gradient descent. This is on by default.
+    static void setRefinement(bool refine);
+
+    // Whether quantized colors are refined.
+    static bool refinement;
 
   private:
 
+    // The fixed-point engine shares the effort levels.
+    friend class FixedBlock;
+
+    // Search parameters of an effort level.
+    struct Effort {
+        // Number of starting points along the principal axis.
+        int candidates;
+        // Gradient descent iterations for each starting point.
+        int short_iterations;
+        // Gradient descent iterations for the best starting point.
+        int iterations;
+        // Maximum number of 565 refinement sweeps.
+        int sweeps;
+        // Gradient descent iterations for the best starting point when refining.
+        // Refinement replaces most of the final descent.
+        int refined_iterations;
+    };
+
+    // Maximum number of starting points of any effort level.
+    static const int MAX_CANDIDATES = 5;
+
+    // Search parameters for each effort level.
+    static Effort effortLevel[EFFORTS];
+
     // Returns squared compression error using the palette.
     float compute_error(DxtPalette const& palette) const;
 
+    // Encodes all pixels using the palette. Returns total squared error and
+    // accumulates error gradients. If bitmap is not null, pixel colors are stored there.
+    float encode(DxtPalette const& palette, Vec3& gradient0, Vec3& gradient1, uint32_t* bitmap = nullptr) const;
+
     // Runs gradient descent to fine-tune the palette.
     float gradient_descent(int max_iterations, DxtPalette& palette);
 
+    // Pixels as read, in bitmap order, for recovering blocks that are already DXT1 decoded.
+    Pixel pixels_[N];
+
     // Pixels are stored in floating point for convenience.
     // Components contain 8 bits per pixel values multiplied by importance.
     valarray<Vec3> data_;
    
     float error_;
 
+    DxtPalette palette_;
+
 }; // class PixelBlock
 
 
@@ -3,10 +3,18 @@
 #include <cstdint>
 #include <exception>
 #include <iostream>
+#include <sstream>
+#include <memory>
+#include <algorithm>
 
 #include "Pixmap.h"
 #include "PixelBlock.h"
+#include "FixedBlock.h"
 #include "DxtBlock.h"
+#include "DdsHeader.h"
+#include "JobQueue.h"
+#include "OutputFile.h"
+#include "ErrorStats.h"
 #include "Common.h"
 
 using namespace std;
@@ -54,14 +62,21 @@ void Pixmap::resize(int sizeX, int sizeY)
 {
     sizeX_ = sizeX;
     sizeY_ = sizeY;
-    data_.resize(sizeX * sizeY);
+    data_.resize((size_t)sizeX * sizeY);
 }
 
 
-void Pixmap::read_bmp(istream &s, bool verbose)
-{
-    // Read header.
+// The parts of a BMP header needed to read the pixels.
+struct BmpHeader {
+    int width;
+    int height;
+    uint32_t bitmapOffset;
+};
 
+
+// Reads and checks a BMP header. Throws runtime_error if the format is not supported.
+BmpHeader read_bmp_header(istream& s)
+{
     auto fileType = read_16_le(s);
     if (fileType != 'MB') throw runtime_error("BMP filetype header not found.");
     skip(s, 8);
@@ -80,25 +95,66 @@ void Pixmap::read_bmp(istream &s, bool verbose)
         if (compression != 0) throw runtime_error("Only uncompressed BMP files are supported.");
     }
 
+    return BmpHeader { width, height, bitmapOffset };
+}
+
+
+void Pixmap::read_bmp(istream &s, bool verbose)
+{
+    auto header = read_bmp_header(s);
+
     // Read bitmap data.
 
-    resize(width, height);
-    s.seekg(bitmapOffset, ios::beg);
-    if (verbose) cerr << "Reading " << width << "x" << height << " BMP image.\n";
+    resize(header.width, header.height);
+    s.seekg(header.bitmapOffset, ios::beg);
+    if (verbose) cerr << "Reading " << header.width << "x" << header.height << " BMP image.\n";
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
+    for (int y = 0; y < header.height; ++y) {
+        for (int x = 0; x < header.width; ++x) {
             (*this)(x, y) = Pixel::read(s);
         }
     }
 }
 
-void Pixmap::export_bmp(ostream &s, bool verbose)
+
+void Pixmap::read_bmp_size(istream& s, int& width, int& height)
 {
-    int bitmapOffset = 54;
-    int filesize = bitmapOffset + 3 * sizeX() * sizeY();
+    auto header = read_bmp_header(s);
+    width = header.width;
+    height = header.height;
+}
 
-    // Write header.
+
+void Pixmap::read_bmp_rows(istream& s, int y0, int rows, bool verbose)
+{
+    auto header = read_bmp_header(s);
+    if (y0 < 0 || rows < 0 || y0 + rows > header.height) throw runtime_error("BMP rows are outside the image.");
+
+    // Rows are stored bottom up and need no padding, as the width is divisible by 4.
+    resize(header.width, rows);
+    s.seekg(header.bitmapOffset + (streamoff)3 * header.width * y0, ios::beg);
+    if (verbose) cerr << "Reading rows " << y0 << " to " << y0 + rows << " of " << header.width << "x" << header.height << " BMP image.\n";
+
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < header.width; ++x) {
+            (*this)(x, y) = Pixel::read(s);
+        }
+    }
+    if (!s) throw runtime_error("Unexpected end of BMP file.");
+}
+
+// Returns the number of padding bytes at the end of each BMP row of the width.
+// Rows are padded to a multiple of 4 bytes.
+int bmp_row_padding(int width)
+{
+    return (4 - 3 * width % 4) % 4;
+}
+
+// Writes the header of a 24-bit uncompressed BMP stream.
+void write_bmp_header(ostream &s, int width, int height)
+{
+    int bitmapOffset = 54;
+    int filesize = bitmapOffset + (3 * width + bmp_row_padding(width)) * height;
 
     write_16_le(s, 'MB');
     write_32_le(s, filesize);
@@ -106,8 +162,8 @@ void Pixmap::export_bmp(ostream &s, bool verbose)
     write_32_le(s, bitmapOffset);
     // Write a BMP version 3.X file.
     write_32_le(s, 40);
-    write_32_le(s, sizeX());
-    write_32_le(s, sizeY());
+    write_32_le(s, width);
+    write_32_le(s, height);
     // Planes, BPP, Compression, SizeOfBitmap, HorzResolution, VertResolution, ColorsUsed, ColorsImportant.
     write_16_le(s, 1);
     write_16_le(s, 24);
@@ -117,6 +173,15 @@ void Pixmap::export_bmp(ostream &s, bool verbose)
     write_32_le(s, 100);
     write_32_le(s, 1 << 24);
     write_32_le(s, 0);
+}
+
+void Pixmap::export_bmp(ostream &s, bool verbose)
+{
+    int rowPadding = bmp_row_padding(sizeX());
+
+    // Write header.
+
+    write_bmp_header(s, sizeX(), sizeY());
 
     // Write bitmap data.
 
@@ -124,98 +189,317 @@ void Pixmap::export_bmp(ostream &s, bool verbose)
         for (int x = 0; x < sizeX(); ++x) {
             (*this)(x, y).write(s);
         }
+        for (int i = 0; i < rowPadding; ++i) s.put(0);
     }
 }
 
-void Pixmap::read_dxt1(istream &s, bool verbose)
-{
-    auto filetype = read_32_le(s);
-    if (filetype != ' SDD') throw runtime_error("DDS filetype header not found.");
-    // Header length.
-    int headerLength = read_32_le(s);
-    if (headerLength != 124) throw runtime_error("Invalid DDS header length.");
-    auto flags = read_32_le(s);
-    int height = read_32_le(s);
-    int width = read_32_le(s);
-    if (width & 3) throw runtime_error("DDS image width must be divisible by 4.");
-    if (height & 3) throw runtime_error("DDS image height must be divisible by 4.");
-    int linearSize = read_32_le(s);
-    int depth = read_32_le(s);
-    int mipmapcount = read_32_le(s);
-    skip(s, 4 * 11);
-    int formatHeaderLength = read_32_le(s);
-    int dwFlags = read_32_le(s);
-    if (dwFlags != 4) throw runtime_error("Only compressed non-alpha RGB files supported.");
-    int fourcc = read_32_le(s);
-    if (fourcc != '1TXD') throw runtime_error("Only DXT1 compressed files supported.");
-    skip(s, 4 * 5);
-    int content = read_32_le(s);
-    if (content != 0x1000) throw runtime_error("DDS file content must be texture.");
-    skip(s, 4 * 4);
-    
-    if (verbose) cerr << "Reading " << width << "x" << height << " DDS image.\n";
+// Reads the header of a DXT1 DDS stream and seeks to the block data of a mipmap level
+// of a surface. Returns the header. Throws runtime_error if there is no such level or surface.
+DdsHeader seek_dxt1(istream &s, bool verbose, int level, int surface)
+{
+    DdsHeader header;
+    header.read(s);
+    if (level < 0 || level >= header.mipmapCount) throw runtime_error("DDS file does not have the requested mipmap level.");
+    if (surface < 0 || surface >= header.surfaceCount()) throw runtime_error("DDS file does not have the requested surface.");
+    s.seekg(surface * header.surfaceSize(), ios::cur);
+    for (int i = 0; i < level; ++i) s.seekg(header.levelSize(i), ios::cur);
+
+    if (verbose) {
+        cerr << "Reading " << header.levelWidth(level) << "x" << header.levelHeight(level) << " DDS image";
+        if (header.surfaceCount() > 1) cerr << " (surface " << surface << " of " << header.surfaceCount() << ")";
+        if (header.mipmapCount > 1) cerr << " (mipmap level " << level << " of " << header.mipmapCount << ")";
+        cerr << ".\n";
+    }
+
+    return header;
+}
+
+void Pixmap::read_dxt1(istream &s, bool verbose, int level, int surface)
+{
+    auto header = seek_dxt1(s, verbose, level, surface);
+    int width = header.levelWidth(level);
+    int height = header.levelHeight(level);
 
     // Read pixel block data. Note that they are written upside down.
+    // The last block row and column may be partial.
     resize(width, height);
 
     DxtBlock dxt;
 
-    for (int y = sizeY() - 4; y >= 0; y -= 4) {
+    for (int y = sizeY() - 4; y > -4; y -= 4) {
         for (int x = 0; x < sizeX(); x += 4) {
             dxt.read(s);
             dxt.decode(*this, x, y);
         }
     }
+
+    if (!s) throw runtime_error("Unexpected end of DDS file.");
 }
 
-void Pixmap::export_dxt1(ostream &s, bool verbose)
+void Pixmap::convert_dxt1_to_bmp(istream& dds, ostream& bmp, bool verbose, int level, int surface)
 {
-    // Write header.
+    auto header = seek_dxt1(dds, verbose, level, surface);
+    int width = header.levelWidth(level);
+    int height = header.levelHeight(level);
+    int blocksX = (width + 3) / 4;
+    int blocksY = (height + 3) / 4;
+
+    auto start = dds.tellg();
+    if (!dds || start < 0) throw runtime_error("Cannot seek in DDS file.");
+
+    write_bmp_header(bmp, width, height);
+
+    // DDS block rows are stored top down and BMP rows bottom up, so block rows are read
+    // from the last one. Each is decoded into a band of 4 rows, which are written as soon
+    // as they are complete. The last block row may be partial and hang below the image.
+    Pixmap band;
+    band.resize(width, DxtBlock::SIZE);
+    vector<char> row(3 * width + bmp_row_padding(width), 0);
+    DxtBlock dxt;
 
-    write_32_le(s, ' SDD');
-    // Header length.
-    write_32_le(s, 124);
-    // Data flags (CAPS, HEIGHT, WIDTH, PIXELFORMAT, LINEARSIZE).
-    write_32_le(s, 0x1 + 0x2 + 0x4 + 0x1000 + 0x80000);
-    write_32_le(s, sizeY());
-    write_32_le(s, sizeX());
-    // PitchOrLinearSize, Depth, MipMapCount, dwReserved[11].
-    write_32_le(s, sizeX() / 4 * sizeY() / 4 * 8);
-    write_32_le(s, 0);
-    write_32_le(s, 0);
-    for (int i = 0; i < 11; ++i) write_32_le(s, 0);
-    // Pixel format: dwSize, dwFlags, dwFourCC, dwRGBBitCount, dw[R, G, B, A]BitMask.
-    write_32_le(s, 32);
-    write_32_le(s, 0x4); // DDPF_FOURCC
-    write_32_le(s, '1TXD');
-    write_32_le(s, 0);
-    write_32_le(s, 0xff0000); 
-    write_32_le(s, 0x00ff00);
-    write_32_le(s, 0x0000ff);
-    write_32_le(s, 0);
-    // dwCaps, dwCaps[2..4], dwReserved2.
-    write_32_le(s, 0x1000); // DDSCAPS_TEXTURE
-    write_32_le(s, 0);
-    write_32_le(s, 0);
-    write_32_le(s, 0);
-    write_32_le(s, 0);
+    for (int by = blocksY - 1; by >= 0; --by) {
+        dds.seekg(start + (streamoff)8 * by * blocksX);
+        for (int bx = 0; bx < blocksX; ++bx) {
+            dxt.read(dds);
+            dxt.decode(band, bx * 4, 0);
+        }
+        if (!dds) throw runtime_error("Unexpected end of DDS file.");
+
+        int y0 = height - 4 - by * 4;
+        for (int y = max(0, -y0); y < DxtBlock::SIZE; ++y) {
+            for (int x = 0; x < width; ++x) {
+                auto const& pixel = band(x, y);
+                row[3 * x] = pixel.r;
+                row[3 * x + 1] = pixel.g;
+                row[3 * x + 2] = pixel.b;
+            }
+            bmp.write(row.data(), row.size());
+        }
+    }
 
-    PixelBlock block;
-    float error = 0;
+    if (!bmp) throw runtime_error("Cannot write BMP file.");
+}
 
-    // Export pixel blocks. Note that they are written upside down.
-    for (int y = sizeY() - 4; y >= 0; y -= 4) {
-        for (int x = 0; x < sizeX(); x += 4) {
-            block.read(*this, x, y);
-            auto dxt = block.compress_dxt1();
-            error += block.error();
-            dxt.write(s);
+void Pixmap::export_dxt1(ostream &s, bool verbose, bool mips, Pixmap* preview, ErrorStats* stats)
+{
+    export_dxt1(s, { this }, false, verbose, mips, preview, stats);
+}
+
+void Pixmap::export_dxt1(string const& filename, bool verbose, bool mips, Pixmap* preview, ErrorStats* stats)
+{
+    export_dxt1(filename, { this }, false, verbose, mips, preview, stats);
+}
+
+void Pixmap::export_dxt1(ostream &s, vector<Pixmap const*> const& surfaces, bool cubemap, bool verbose,
+                         bool mips, Pixmap* preview, ErrorStats* stats)
+{
+    vector<uint8_t> dds(dds_size(surfaces, cubemap, mips));
+    compress_dds(dds.data(), surfaces, cubemap, verbose, mips, preview, stats);
+    s.write((char const*)dds.data(), dds.size());
+}
+
+void Pixmap::export_dxt1(string const& filename, vector<Pixmap const*> const& surfaces, bool cubemap, bool verbose,
+                         bool mips, Pixmap* preview, ErrorStats* stats)
+{
+    OutputFile file(filename, dds_size(surfaces, cubemap, mips));
+    compress_dds(file.data(), surfaces, cubemap, verbose, mips, preview, stats);
+    file.close();
+}
+
+// Returns the DDS header of the surfaces. Throws runtime_error if they do not fit together.
+DdsHeader surface_header(vector<Pixmap const*> const& surfaces, bool cubemap, bool mips)
+{
+    if (surfaces.empty()) throw runtime_error("No surfaces to compress.");
+    if (cubemap && surfaces.size() % 6 != 0) throw runtime_error("Cube maps must have 6 faces.");
+
+    DdsHeader header(surfaces[0]->sizeX(), surfaces[0]->sizeY());
+    for (auto surface : surfaces) {
+        if (surface->sizeX() != header.width || surface->sizeY() != header.height)
+            throw runtime_error("All surfaces must be the same size.");
+    }
+    if (cubemap && header.width != header.height) throw runtime_error("Cube map faces must be square.");
+
+    if (mips) header.mipmapCount = header.fullMipmapCount();
+    header.cubemap = cubemap;
+    header.arraySize = (int)surfaces.size() / (cubemap ? 6 : 1);
+    return header;
+}
+
+size_t Pixmap::dds_size(vector<Pixmap const*> const& surfaces, bool cubemap, bool mips)
+{
+    return surface_header(surfaces, cubemap, mips).fileSize();
+}
+
+void Pixmap::compress_dds(uint8_t* output, vector<Pixmap const*> const& surfaces, bool cubemap, bool verbose,
+                          bool mips, Pixmap* preview, ErrorStats* stats)
+{
+    auto header = surface_header(surfaces, cubemap, mips);
+    int count = (int)surfaces.size();
+
+    // The header is small enough to go through a stream.
+    ostringstream headerStream;
+    header.write(headerStream);
+    auto headerData = headerStream.str();
+    copy(headerData.begin(), headerData.end(), output);
+
+    // Build the mipmap chain of each surface.
+    vector<vector<unique_ptr<Pixmap>>> chains(count);
+
+    for (int surface = 0; surface < count; ++surface) {
+        auto& chain = chains[surface];
+        for (int level = 1; level < header.mipmapCount; ++level) {
+            Pixmap const& source = level == 1 ? *surfaces[surface] : *chain.back();
+            chain.emplace_back(new Pixmap());
+            source.downsample(*chain.back());
         }
     }
 
+    // Compress all surfaces and levels through one queue. Jobs of the full size images
+    // of every surface start first and the small levels fill in at the end, so that
+    // all threads are busy from the start even if there are more threads than bands
+    // in one surface. Each job stores its blocks at their final offsets in the output,
+    // where each surface is followed by its mipmap levels.
+    // The first surface is decoded into the preview by the jobs that compress it.
+    JobQueue queue;
+    vector<vector<float>> errors(header.mipmapCount * count);
+    vector<vector<ErrorStats>> bandStats(count);
+    size_t levelOffset = header.headerSize();
+
+    if (preview) preview->resize(header.width, header.height);
+
+    for (int level = 0; level < header.mipmapCount; ++level) {
+        for (int surface = 0; surface < count; ++surface) {
+            Pixmap const& source = level == 0 ? *surfaces[surface] : *chains[surface][level - 1];
+            auto levelOutput = output + levelOffset + surface * header.surfaceSize();
+            auto& levelErrors = errors[level * count + surface];
+            if (level == 0)
+                source.compress_dxt1(queue, levelOutput, levelErrors, surface == 0 ? preview : nullptr, stats ? &bandStats[surface] : nullptr);
+            else
+                source.compress_dxt1(queue, levelOutput, levelErrors);
+        }
+        levelOffset += header.levelSize(level);
+    }
+
+    queue.run();
+
+    float error = 0;
+    for (int surface = 0; surface < count; ++surface)
+        for (auto band_error : errors[surface]) error += band_error;
+
+    if (stats) {
+        *stats = ErrorStats();
+        for (auto& surface_stats : bandStats)
+            for (auto& band_stats : surface_stats) stats->add(band_stats);
+    }
+
     if (verbose) {
-        cerr << "DDS image written. Weighted RMS error per pixel: "
-             << sqrt(error / (float)sizeX() / (float)sizeY()) * 100.0f / 256.0f
+        cerr << "DDS image written";
+        if (header.cubemap) cerr << " with " << header.arraySize << " cube map" << (header.arraySize > 1 ? "s" : "");
+        else if (count > 1) cerr << " with " << count << " surfaces";
+        if (header.mipmapCount > 1) cerr << (count > 1 ? " and " : " with ") << header.mipmapCount << " mipmap levels";
+        cerr << ". Weighted RMS error per pixel: "
+             << sqrt(error / (float)header.width / (float)header.height / (float)count) * 100.0f / 256.0f
              << "%.\n";
     }
 }
+
+// Decodes the block compressed from the pixmap at (x, y) into the preview and adds
+// its errors to the statistics, if given. Pixels outside the pixmap are skipped.
+void decode_block(Pixmap const& pixmap, DxtBlock const& dxt, int x, int y, Pixmap* preview, ErrorStats* stats)
+{
+    Pixel pixels[DxtBlock::SIZE * DxtBlock::SIZE];
+    dxt.decode(pixels);
+
+    // Blocks are encoded upside down.
+    for (int dy = DxtBlock::SIZE - 1, i = 0; dy >= 0; --dy) {
+        for (int dx = 0; dx < DxtBlock::SIZE; ++dx, ++i) {
+            if (x + dx >= pixmap.sizeX() || y + dy < 0 || y + dy >= pixmap.sizeY()) continue;
+            if (preview) (*preview)(x + dx, y + dy) = pixels[i];
+            if (stats) stats->add(pixmap(x + dx, y + dy), pixels[i]);
+        }
+    }
+}
+
+// Compresses block rows [first, last) of the pixmap with the block type (PixelBlock or
+// FixedBlock) and stores the blocks at the output, which holds the blocks of the rows
+// in DDS file order. Decodes the blocks into the preview and the statistics,
+// if given. Returns the weighted squared error of the rows.
+template <class Block> float compress_band(Pixmap const& pixmap, uint8_t* output, int first, int last, Pixmap* preview, ErrorStats* stats)
+{
+    int blocksX = (pixmap.sizeX() + 3) / 4;
+    Block block;
+    float error = 0;
+
+    // Final palettes of the current and previous block rows for warm starting.
+    vector<typename Block::Palette> above(blocksX);
+    vector<typename Block::Palette> current(blocksX);
+
+    for (int by = first; by < last; ++by) {
+        // Blocks are stored upside down.
+        int y = pixmap.sizeY() - 4 - by * 4;
+        for (int bx = 0; bx < blocksX; ++bx) {
+            block.read(pixmap, bx * 4, y);
+            auto dxt = block.compress_dxt1(bx > 0 ? &current[bx - 1] : nullptr, by > first ? &above[bx] : nullptr);
+            dxt.store(output + 8 * ((size_t)(by - first) * blocksX + bx));
+            if (preview || stats) decode_block(pixmap, dxt, bx * 4, y, preview, stats);
+            current[bx] = block.palette();
+            error += block.error();
+        }
+        swap(above, current);
+    }
+
+    return error;
+}
+
+void Pixmap::compress_dxt1(JobQueue& queue, uint8_t* output, vector<float>& errors, Pixmap* preview, vector<ErrorStats>* stats) const
+{
+    compress_rows(queue, 0, (sizeY() + 3) / 4, output, errors, preview, stats);
+}
+
+void Pixmap::compress_rows(JobQueue& queue, int first, int last, uint8_t* output, vector<float>& errors,
+                           Pixmap* preview, vector<ErrorStats>* stats) const
+{
+    // Bands that overlap the rows.
+    int firstBand = first / WARM_START_ROWS;
+    int bands = max(0, (last + WARM_START_ROWS - 1) / WARM_START_ROWS - firstBand);
+
+    errors.assign(bands, 0.0f);
+    if (stats) stats->assign(errors.size(), ErrorStats());
+
+    // Each band of WARM_START_ROWS block rows is a job. Warm starts only use neighbors
+    // within the band, so the results do not depend on scheduling.
+    for (int band = 0; band < bands; ++band) {
+        queue.add([this, output, &errors, preview, stats, band, firstBand, first, last]() {
+            int band_first = max(first, (firstBand + band) * WARM_START_ROWS);
+            int band_last = min(last, (firstBand + band + 1) * WARM_START_ROWS);
+            auto band_output = output + 8 * (size_t)(band_first - first) * ((sizeX() + 3) / 4);
+            auto band_stats = stats ? &(*stats)[band] : nullptr;
+            if (PixelBlock::fixedPoint)
+                errors[band] = compress_band<FixedBlock>(*this, band_output, band_first, band_last, preview, band_stats);
+            else
+                errors[band] = compress_band<PixelBlock>(*this, band_output, band_first, band_last, preview, band_stats);
+        });
+    }
+}
+
+void Pixmap::downsample(Pixmap& target) const
+{
+    target.resize(max(1, sizeX() / 2), max(1, sizeY() / 2));
+
+    for (int y = 0; y < target.sizeY(); ++y) {
+        int y0 = 2 * y;
+        int y1 = min(y0 + 1, sizeY() - 1);
+        for (int x = 0; x < target.sizeX(); ++x) {
+            int x0 = 2 * x;
+            int x1 = min(x0 + 1, sizeX() - 1);
+            auto const& a = (*this)(x0, y0);
+            auto const& b = (*this)(x1, y0);
+            auto const& c = (*this)(x0, y1);
+            auto const& d = (*this)(x1, y1);
+            target(x, y) = Pixel(
+                (a.r + b.r + c.r + d.r + 2) >> 2,
+                (a.g + b.g + c.g + d.g + 2) >> 2,
+                (a.b + b.b + c.b + d.b + 2) >> 2);
+        }
+    }
+}
@@ -5,12 +5,17 @@
 #define PIXMAP_H
 
 #include <vector>
+#include <string>
 #include <fstream>
 #include <cstdint>
 
 using namespace std;
 
 
+class JobQueue;
+struct ErrorStats;
+
+
 // 24-bit RGB pixel.
 struct Pixel {
   uint8_t r;
@@ -41,10 +46,14 @@ class Pixmap {
     int sizeY_;
     vector<Pixel> data_;
 
-    int offset(int x, int y) const { return y * sizeX_ + x; }
+    size_t offset(int x, int y) const { return (size_t)y * sizeX_ + x; }
 
   public:
 
+    // Number of block rows in a band. Bands are compressed in parallel and blocks are
+    // warm started from their upper neighbors only within a band.
+    static const int WARM_START_ROWS = 16;
+
     Pixmap() { }
 
     // Prohibit copy construction.
@@ -68,14 +77,77 @@ class Pixmap {
     // Reads a 24-bit uncompressed BMP stream. Throws runtime_error if something goes wrong.
     void read_bmp(istream&, bool verbose);
 
+    // Reads the size of a 24-bit uncompressed BMP stream from its header.
+    // Throws runtime_error if the format is not supported.
+    static void read_bmp_size(istream&, int& width, int& height);
+
+    // Reads pixel rows [y0, y0 + rows) of a 24-bit uncompressed BMP stream, so that row 0 of
+    // the pixmap is row y0 of the image. Only those rows are read from the stream, which must
+    // be seekable. Throws runtime_error if the rows are not in the image.
+    void read_bmp_rows(istream&, int y0, int rows, bool verbose);
+
     // Writes a 24-bit uncompressed BMP stream.
     void export_bmp(ostream&, bool verbose);
 
-    // Reads a DXT1 DDS stream. Throws runtime_error if something goes wrong.
-    void read_dxt1(istream&, bool verbose);
-
-    // Writes a DXT1 DDS stream.
-    void export_dxt1(ostream&, bool verbose);
+    // Reads a mipmap level of a surface of a DXT1 DDS stream. Level 0 is the full size image.
+    // Surfaces are texture array elements and cube map faces in file order.
+    // Throws runtime_error if something goes wrong.
+    void read_dxt1(istream&, bool verbose, int level = 0, int surface = 0);
+
+    // Decodes a mipmap level of a surface of a DXT1 DDS stream into a 24-bit uncompressed
+    // BMP stream one block row at a time, in memory proportional to the width. Block rows
+    // are read bottom up, so the DDS stream must be seekable. The output is the same as
+    // from read_dxt1 followed by export_bmp. Throws runtime_error if something goes wrong.
+    static void convert_dxt1_to_bmp(istream& dds, ostream& bmp, bool verbose, int level = 0, int surface = 0);
+
+    // Writes a DXT1 DDS stream, optionally with a full mipmap chain. If preview is given,
+    // it receives the decoded full size image. If stats is given, it receives the
+    // unweighted errors of the full size image.
+    void export_dxt1(ostream&, bool verbose, bool mips = false, Pixmap* preview = nullptr, ErrorStats* stats = nullptr);
+
+    // Writes a DXT1 DDS file like the stream version does. The file is created at its
+    // final size and compression jobs store their blocks directly into it.
+    // Throws runtime_error if the file cannot be written.
+    void export_dxt1(string const& filename, bool verbose, bool mips = false, Pixmap* preview = nullptr, ErrorStats* stats = nullptr);
+
+    // Writes the pixmaps as the surfaces of one DXT1 DDS stream: a texture array, or with
+    // cubemap, cube maps of 6 faces each. The pixmaps must be the same size and cube map
+    // faces must be square. The preview receives the first surface and the statistics
+    // cover the full size images of all surfaces. Throws runtime_error if the surfaces
+    // do not fit together.
+    static void export_dxt1(ostream&, vector<Pixmap const*> const& surfaces, bool cubemap, bool verbose,
+                            bool mips = false, Pixmap* preview = nullptr, ErrorStats* stats = nullptr);
+
+    // Writes the surfaces as a DXT1 DDS file like the stream version does.
+    static void export_dxt1(string const& filename, vector<Pixmap const*> const& surfaces, bool cubemap, bool verbose,
+                            bool mips = false, Pixmap* preview = nullptr, ErrorStats* stats = nullptr);
+
+    // Size of the DXT1 DDS file of the surfaces in bytes.
+    static size_t dds_size(vector<Pixmap const*> const& surfaces, bool cubemap, bool mips);
+
+    // Compresses the surfaces into a DXT1 DDS file of dds_size() bytes in memory.
+    // All surfaces and mipmap levels are compressed through one job queue.
+    // Arguments are as in export_dxt1.
+    static void compress_dds(uint8_t* output, vector<Pixmap const*> const& surfaces, bool cubemap, bool verbose,
+                             bool mips, Pixmap* preview = nullptr, ErrorStats* stats = nullptr);
+
+    // Adds jobs to the queue that compress this pixmap into DXT1 blocks stored at the
+    // output in DDS file order. Partial blocks at the edges are padded by repeating edge
+    // pixels. The weighted squared error of each band of block rows is stored in errors.
+    // If preview is given, it must be the size of this pixmap and each job decodes its
+    // blocks into it. If stats is given, the unweighted errors of each band are stored
+    // there. Results are available after the queue has run.
+    void compress_dxt1(JobQueue& queue, uint8_t* output, vector<float>& errors,
+                       Pixmap* preview = nullptr, vector<ErrorStats>* stats = nullptr) const;
+
+    // Like compress_dxt1, but compresses only block rows [first, last) in DDS file order and
+    // the output holds the blocks of those rows. Bands are aligned to the whole image, so if
+    // first is a multiple of WARM_START_ROWS, the blocks are the same as in the whole image.
+    void compress_rows(JobQueue& queue, int first, int last, uint8_t* output, vector<float>& errors,
+                       Pixmap* preview = nullptr, vector<ErrorStats>* stats = nullptr) const;
+    // Writes a half size version of this pixmap into the target using a 2x2 box filter.
+    // Sizes are rounded down but are at least 1.
+    void downsample(Pixmap& target) const;
 
 }; // class Pixmap
 
@@ -0,0 +1,245 @@
+// Shard.cpp
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+
+#include "Shard.h"
+#include "Cache.h"
+#include "DdsHeader.h"
+#include "JobQueue.h"
+#include "OutputFile.h"
+#include "Common.h"
+
+using namespace std;
+using namespace std::chrono;
+
+
+// Version of the shard file format.
+const int SHARD_VERSION = 2;
+
+// Length of the key of the input pixels and encoder settings in characters.
+const int SHARD_KEY_SIZE = 16;
+
+// Spacing of the pixel rows that every shard reads for the key.
+const int SHARD_SAMPLE_SPACING = 16;
+
+// Size of the shard file header in bytes: magic number, version, key, width, height, index,
+// count, first and last block row, squared error (64 bits), error count (64 bits),
+// maximum error, weighted error (float bits) and compression time (double bits).
+const int SHARD_HEADER_SIZE = 4 + 4 + SHARD_KEY_SIZE + 6 * 4 + 8 + 8 + 4 + 4 + 8;
+
+
+// The header of a shard file.
+struct ShardInfo {
+    string filename;
+    string key;
+    int width;
+    int height;
+    int index;
+    int count;
+    // Block rows [first, last) in DDS file order.
+    int first;
+    int last;
+    ErrorStats stats;
+    // Weighted squared error of the blocks.
+    float error;
+    // Time taken to compress and write the shard in seconds.
+    double seconds;
+};
+
+
+// Reads 8 little-endian bytes.
+uint64_t read_64_le(istream& s)
+{
+    uint64_t low = read_32_le(s);
+    uint64_t high = read_32_le(s);
+    return low + (high << 32);
+}
+
+
+// Reads the header of a shard file. Throws runtime_error if it is not a shard file.
+ShardInfo read_shard(istream& s, string const& filename)
+{
+    ShardInfo info;
+    info.filename = filename;
+
+    if (read_32_le(s) != 'HSDB' || read_32_le(s) != (uint32_t)SHARD_VERSION || !s)
+        throw runtime_error(filename + " is not a shard file of this version.");
+
+    char key[SHARD_KEY_SIZE];
+    s.read(key, SHARD_KEY_SIZE);
+    info.key.assign(key, SHARD_KEY_SIZE);
+    info.width = read_32_le(s);
+    info.height = read_32_le(s);
+    info.index = read_32_le(s);
+    info.count = read_32_le(s);
+    info.first = read_32_le(s);
+    info.last = read_32_le(s);
+    info.stats.squared = (double)read_64_le(s);
+    info.stats.count = (int64_t)read_64_le(s);
+    info.stats.maximum = read_32_le(s);
+    uint32_t error = read_32_le(s);
+    memcpy(&info.error, &error, sizeof(error));
+    uint64_t seconds = read_64_le(s);
+    memcpy(&info.seconds, &seconds, sizeof(seconds));
+
+    if (!s) throw runtime_error("Unexpected end of shard file " + filename + ".");
+    return info;
+}
+
+
+void export_shard(string const& input, string const& filename, int index, int count, bool verbose, ErrorStats* stats)
+{
+    if (count < 1 || index < 0 || index >= count) throw runtime_error("Shard index must be less than the number of shards.");
+
+    ifstream s(input, ios::binary);
+    if (!s.is_open()) throw runtime_error("Cannot open input file.");
+    int width, height;
+    Pixmap::read_bmp_size(s, width, height);
+
+    // Divide whole bands between the shards.
+    int blocksX = (width + 3) / 4;
+    int blocksY = (height + 3) / 4;
+    int bands = (blocksY + Pixmap::WARM_START_ROWS - 1) / Pixmap::WARM_START_ROWS;
+    int first = min(blocksY, index * bands / count * Pixmap::WARM_START_ROWS);
+    int last = min(blocksY, (index + 1) * bands / count * Pixmap::WARM_START_ROWS);
+
+    // Every shard reads every SHARD_SAMPLE_SPACING-th pixel row and the top row, and they go
+    // into the key with the settings. This tells apart shards of different images without
+    // reading the whole image, but not edits that fall between the sampled rows.
+    Pixmap sample, row;
+    sample.resize(width, (height + SHARD_SAMPLE_SPACING - 2) / SHARD_SAMPLE_SPACING + 1);
+    for (int i = 0; i < sample.sizeY(); ++i) {
+        s.seekg(0, ios::beg);
+        row.read_bmp_rows(s, min(height - 1, i * SHARD_SAMPLE_SPACING), 1, false);
+        for (int x = 0; x < width; ++x) sample(x, i) = row(x, 0);
+    }
+    auto key = Cache::key({ &sample }, false, false);
+
+    // The pixmap holds only the rows of the shard. Block rows are stored upside down, so
+    // these are the lowest rows of the pixmap, and first is still aligned to a band.
+    Pixmap pixmap;
+    s.seekg(0, ios::beg);
+    pixmap.read_bmp_rows(s, height - 4 * last, 4 * (last - first), verbose);
+    s.close();
+
+    auto time0 = steady_clock::now();
+
+    OutputFile file(filename, SHARD_HEADER_SIZE + 8 * (size_t)(last - first) * blocksX);
+    auto output = file.data();
+
+    JobQueue queue;
+    vector<float> errors;
+    vector<ErrorStats> bandStats;
+    pixmap.compress_rows(queue, 0, last - first, output + SHARD_HEADER_SIZE, errors, nullptr, &bandStats);
+    queue.run();
+
+    float error = 0;
+    for (auto band_error : errors) error += band_error;
+    ErrorStats total;
+    for (auto& band_stats : bandStats) total.add(band_stats);
+
+    uint32_t errorBits;
+    memcpy(&errorBits, &error, sizeof(error));
+    auto squared = (uint64_t)total.squared;
+    // The time covers compressing and storing the blocks; closing adds little for a mapped file.
+    double seconds = duration<double>(steady_clock::now() - time0).count();
+    uint64_t secondsBits;
+    memcpy(&secondsBits, &seconds, sizeof(seconds));
+
+    store_32_le(output, 'HSDB');
+    store_32_le(output + 4, SHARD_VERSION);
+    copy(key.begin(), key.begin() + SHARD_KEY_SIZE, output + 8);
+    auto p = output + 8 + SHARD_KEY_SIZE;
+    for (uint32_t x : { (uint32_t)width, (uint32_t)height, (uint32_t)index, (uint32_t)count, (uint32_t)first, (uint32_t)last,
+                        (uint32_t)squared, (uint32_t)(squared >> 32), (uint32_t)total.count, (uint32_t)((uint64_t)total.count >> 32),
+                        (uint32_t)total.maximum, errorBits, (uint32_t)secondsBits, (uint32_t)(secondsBits >> 32) }) {
+        store_32_le(p, x);
+        p += 4;
+    }
+
+    file.close();
+
+    if (stats) *stats = total;
+
+    if (verbose) {
+        cerr << "Shard " << index << " of " << count << " (block rows " << first << " to " << last << ") written.";
+        if (last > first) {
+            cerr << " Weighted RMS error per pixel: "
+                 << sqrt(error / (float)(last - first) / 4.0f / (float)width) * 100.0f / 256.0f << "%.";
+        }
+        cerr << "\n";
+    }
+}
+
+
+void merge_shards(vector<string> const& shards, string const& filename, bool verbose, int& width, int& height, double& seconds, ErrorStats* stats)
+{
+    if (shards.empty()) throw runtime_error("No shards to merge.");
+
+    vector<ShardInfo> infos;
+    for (auto& shard : shards) {
+        ifstream s(shard, ios::binary);
+        if (!s.is_open()) throw runtime_error("Cannot open shard file " + shard + ".");
+        infos.push_back(read_shard(s, shard));
+    }
+    sort(infos.begin(), infos.end(), [](ShardInfo const& a, ShardInfo const& b) { return a.index < b.index; });
+
+    // The shards must come from the same compression and follow each other without gaps.
+    auto const& head = infos[0];
+    int blocksX = (head.width + 3) / 4;
+    int blocksY = (head.height + 3) / 4;
+    if (head.count != (int)infos.size()) throw runtime_error("Expected " + to_string(head.count) + " shards.");
+    for (int i = 0; i < (int)infos.size(); ++i) {
+        auto const& info = infos[i];
+        if (info.key != head.key || info.width != head.width || info.height != head.height || info.count != head.count)
+            throw runtime_error("Shard file " + info.filename + " is from a different image or settings.");
+        if (info.index != i) throw runtime_error("Shard " + to_string(i) + " is missing or repeated.");
+        if (info.first != (i > 0 ? infos[i - 1].last : 0) || info.last < info.first || info.last > blocksY)
+            throw runtime_error("Shard file " + info.filename + " has the wrong block rows.");
+    }
+    if (infos.back().last != blocksY) throw runtime_error("Shards do not cover the image.");
+
+    DdsHeader header(head.width, head.height);
+    OutputFile file(filename, header.fileSize());
+    auto output = file.data();
+
+    // The header is small enough to go through a stream.
+    ostringstream headerStream;
+    header.write(headerStream);
+    auto headerData = headerStream.str();
+    copy(headerData.begin(), headerData.end(), output);
+
+    float error = 0;
+    ErrorStats total;
+    seconds = 0;
+
+    for (auto& info : infos) {
+        ifstream s(info.filename, ios::binary);
+        s.seekg(SHARD_HEADER_SIZE);
+        s.read((char*)output + header.headerSize() + 8 * (size_t)info.first * blocksX, 8 * (size_t)(info.last - info.first) * blocksX);
+        if (!s) throw runtime_error("Unexpected end of shard file " + info.filename + ".");
+        error += info.error;
+        total.add(info.stats);
+        seconds += info.seconds;
+    }
+
+    file.close();
+
+    width = head.width;
+    height = head.height;
+    if (stats) *stats = total;
+
+    if (verbose) {
+        cerr << "DDS image merged from " << infos.size() << " shards. Weighted RMS error per pixel: "
+             << sqrt(error / (float)head.width / (float)head.height) * 100.0f / 256.0f
+             << "%.\n";
+    }
+}
@@ -0,0 +1,35 @@
+// Shard.h
+// Compression of an image in block row shards and merging of the shards into a DDS file.
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <string>
+#include <vector>
+
+#include "Pixmap.h"
+#include "ErrorStats.h"
+
+using namespace std;
+
+
+// Compresses shard index of count of a BMP file into a shard file. The bands of block rows
+// are divided evenly between the shards, so the blocks are the same as when compressing the
+// whole image. Only the pixel rows of the shard and every 16th row of the image are read.
+// A shard file holds the raw DXT1 blocks of its rows in DDS file order with their error
+// statistics and compression time, and a key of the encoder settings and the sampled rows.
+// If stats is given, it receives the unweighted errors of the shard. Throws runtime_error
+// if something goes wrong.
+void export_shard(string const& input, string const& filename, int index, int count, bool verbose, ErrorStats* stats = nullptr);
+
+// Merges shard files, given in any order, into a DXT1 DDS file. The shards must all be made
+// with the same settings from images of the same size and sampled rows, and together cover
+// the image. Changes to an image between the sampled rows are not detected. If stats is given,
+// it receives the unweighted errors of the whole image. Returns the size of the image in width
+// and height and the sum of the compression times of the shards in seconds. Throws
+// runtime_error if the shards do not fit together or something goes wrong.
+void merge_shards(vector<string> const& shards, string const& filename, bool verbose, int& width, int& height, double& seconds,
+                  ErrorStats* stats = nullptr);
+
+
+#endif // SHARD_H